@@ -14,12 +14,16 @@
 #include <zephyr/bluetooth/uuid.h>
 
 #include "battery.h"
+#include "beacon_mac.h"
 #include "bluetooth.h"
 #include "cc1101.h"
 #include "timer.h"
 #include "rgb_led.h"
 #include "persistent.h"
 #include "magic_path_packet.h"
+#include "radio_auth.h"
+#include "radio_dispatcher.h"
+#include "radio_relay.h"
 #include "scoped_mutex_lock.h"
 
 LOG_MODULE_DECLARE();
@@ -28,6 +32,38 @@ namespace {
 
 K_MUTEX_DEFINE(packet_mutex);
 Persistent<MagicPathRadioPacket> packet(0x00000011); // Guarded by packet_mutex
+// Fireflies have the same characteristic, all devices of an installation must use the same profile.
+Persistent<RfProfile> rf_profile(0x00000012, 0x40); // Guarded by packet_mutex
+// First beacon counter not reserved yet. Counters are reserved in blocks, so EEPROM is written
+// once per kCounterReservation beacons, and counters never repeat after a reboot.
+Persistent<uint32_t> counter_reservation(0x00000013, 0x50); // Guarded by packet_mutex
+const uint32_t kCounterReservation = 1 << 16;
+// Fireflies have the same characteristic, see kMagicPathInstallationAddress.
+Persistent<uint8_t> installation_address(0x00000014, 0x60); // Guarded by packet_mutex
+
+const RadioAuthenticator authenticator(kMagicPathKey);
+
+uint32_t NextBeaconCounter() {
+  ScopedMutexLock l(packet_mutex);
+  static uint32_t counter = counter_reservation.value();
+  if (counter == counter_reservation.value()) {
+    counter_reservation.value() += kCounterReservation;
+    counter_reservation.Save();
+  }
+  return counter++;
+}
+
+// Scan response advertises the RF profile, so it can be checked without connecting.
+// Manufacturer specific data: company ID 0xFFFF (none, for internal use), then RfProfile.
+uint8_t rf_profile_manufacturer_data[] = {0xFF, 0xFF, 0x00};
+const bt_data scan_response[] = {
+    BT_DATA(BT_DATA_MANUFACTURER_DATA, rf_profile_manufacturer_data, sizeof(rf_profile_manufacturer_data)),
+};
+
+void AdvertiseRfProfile(RfProfile profile) {
+  rf_profile_manufacturer_data[2] = static_cast<uint8_t>(profile);
+  SetBleScanResponse(scan_response, ARRAY_SIZE(scan_response));
+}
 
 const struct bt_data ad[] = {
     BT_DATA_BYTES(BT_DATA_FLAGS, (BT_LE_AD_GENERAL | BT_LE_AD_NO_BREDR)),
@@ -37,6 +73,11 @@ const struct bt_data ad[] = {
 
 RgbLed led;
 
+// Fireflies expect a beacon every ~37 ms. Activators aren't synchronized, so beacons are jittered
+// rather than slotted: two activators in the same slot would pass carrier sense together and
+// collide on every beacon.
+const BeaconMac::Options kBeaconMacOptions = {.interval_ms = 36};
+
 /* Radio packet ID, UUID 8ec87064-8865-4eca-82e0-2ea8e45e8221 */
 struct bt_uuid_128 radio_packet_id_characteristic_uuid = BT_UUID_INIT_128(
     0x21, 0x82, 0x5e, 0xe4, 0xa8, 0x2e, 0xe0, 0x82,
@@ -57,6 +98,16 @@ struct bt_uuid_128 radio_packet_config_mode_characteristic_uuid = BT_UUID_INIT_1
     0x21, 0x82, 0x5e, 0xe4, 0xa8, 0x2e, 0xe0, 0x82,
     0xca, 0x4e, 0x65, 0x88, 0x67, 0x70, 0xc8, 0x8e);
 
+/* RF profile, UUID 8ec87068-8865-4eca-82e0-2ea8e45e8221 */
+struct bt_uuid_128 rf_profile_characteristic_uuid = BT_UUID_INIT_128(
+    0x21, 0x82, 0x5e, 0xe4, 0xa8, 0x2e, 0xe0, 0x82,
+    0xca, 0x4e, 0x65, 0x88, 0x68, 0x70, 0xc8, 0x8e);
+
+/* Installation address, UUID 8ec8706b-8865-4eca-82e0-2ea8e45e8221 */
+struct bt_uuid_128 installation_address_characteristic_uuid = BT_UUID_INIT_128(
+    0x21, 0x82, 0x5e, 0xe4, 0xa8, 0x2e, 0xe0, 0x82,
+    0xca, 0x4e, 0x65, 0x88, 0x6b, 0x70, 0xc8, 0x8e);
+
 template<size_t Offset, size_t Size> ssize_t read_radio_packet(
   struct bt_conn *conn,
   const struct bt_gatt_attr *attr,
@@ -80,6 +131,56 @@ template<size_t Offset, size_t Size> ssize_t write_radio_packet(
   return len;
 }
 
+ssize_t read_rf_profile(struct bt_conn *conn,
+                        const struct bt_gatt_attr *attr,
+                        void *buf, uint16_t len, uint16_t offset) {
+  ScopedMutexLock l(packet_mutex);
+  return bt_gatt_attr_read(conn, attr, buf, len, offset, &rf_profile.value(), sizeof(RfProfile));
+}
+
+ssize_t write_rf_profile(struct bt_conn *conn,
+                         const struct bt_gatt_attr *attr,
+                         const void *buf, uint16_t len, uint16_t offset,
+                         uint8_t flags) {
+  if (offset != 0 || len != sizeof(RfProfile)) {
+    return BT_GATT_ERR(BT_ATT_ERR_INVALID_OFFSET);
+  }
+  const uint8_t value = *reinterpret_cast<const uint8_t*>(buf);
+  if (value >= kRfProfileCount) {
+    return BT_GATT_ERR(BT_ATT_ERR_VALUE_NOT_ALLOWED);
+  }
+  ScopedMutexLock l(packet_mutex);
+  // Radio is switched to the new profile by the main loop.
+  rf_profile.value() = static_cast<RfProfile>(value);
+  rf_profile.Save();
+  AdvertiseRfProfile(rf_profile.value());
+  return len;
+}
+
+ssize_t read_installation_address(struct bt_conn *conn,
+                                  const struct bt_gatt_attr *attr,
+                                  void *buf, uint16_t len, uint16_t offset) {
+  ScopedMutexLock l(packet_mutex);
+  return bt_gatt_attr_read(conn, attr, buf, len, offset, &installation_address.value(), sizeof(uint8_t));
+}
+
+ssize_t write_installation_address(struct bt_conn *conn,
+                                   const struct bt_gatt_attr *attr,
+                                   const void *buf, uint16_t len, uint16_t offset,
+                                   uint8_t flags) {
+  if (offset != 0 || len != 1) {
+    return BT_GATT_ERR(BT_ATT_ERR_INVALID_OFFSET);
+  }
+  const uint8_t value = *reinterpret_cast<const uint8_t*>(buf);
+  if (!IsValidInstallationAddress(value)) {
+    return BT_GATT_ERR(BT_ATT_ERR_VALUE_NOT_ALLOWED);
+  }
+  ScopedMutexLock l(packet_mutex);
+  installation_address.value() = value;
+  installation_address.Save();
+  return len;
+}
+
 BT_GATT_SERVICE_DEFINE(firefly_service,
                        BT_GATT_PRIMARY_SERVICE(&firefly_service_uuid),
                        BT_GATT_CHARACTERISTIC(&radio_packet_id_characteristic_uuid.uuid,
@@ -98,6 +199,14 @@ BT_GATT_SERVICE_DEFINE(firefly_service,
                                               BT_GATT_CHRC_READ | BT_GATT_CHRC_WRITE,
                                               BT_GATT_PERM_READ | BT_GATT_PERM_WRITE,
                                               (read_radio_packet<7, 1>), (write_radio_packet<7, 1>), nullptr),
+                       BT_GATT_CHARACTERISTIC(&rf_profile_characteristic_uuid.uuid,
+                                              BT_GATT_CHRC_READ | BT_GATT_CHRC_WRITE,
+                                              BT_GATT_PERM_READ | BT_GATT_PERM_WRITE,
+                                              read_rf_profile, write_rf_profile, nullptr),
+                       BT_GATT_CHARACTERISTIC(&installation_address_characteristic_uuid.uuid,
+                                              BT_GATT_CHRC_READ | BT_GATT_CHRC_WRITE,
+                                              BT_GATT_PERM_READ | BT_GATT_PERM_WRITE,
+                                              read_installation_address, write_installation_address, nullptr),
 );
 
 } // namespace
@@ -112,11 +221,21 @@ int main(void) {
     .configure_mode = false
   });
 
+  rf_profile.LoadOrInit(RfProfile::kDefault);
+  counter_reservation.LoadOrInit(0);
+  installation_address.LoadOrInit(kMagicPathInstallationAddress);
+  if (!IsValidInstallationAddress(installation_address.value())) {
+    installation_address.value() = kMagicPathInstallationAddress;
+  }
+  AdvertiseRfProfile(rf_profile.value());
+
   led.SetColorSmooth(packet.value().color, 1000);
 
   Cc1101 cc1101;
   cc1101.Init();
   cc1101.SetChannel(1);
+  // Radio is idle for most of the beacon interval.
+  cc1101.SetAutoSleep(true);
 
   led.EnablePowerStabilizer();
 
@@ -125,9 +244,27 @@ int main(void) {
     SetBatteryLevel(v / 30);
   }, 5000);
 
+  BeaconMac mac(cc1101, kBeaconMacOptions);
   while (true) {
-    ScopedMutexLock l(packet_mutex);
-    cc1101.Transmit(packet.value());
-    k_sleep(K_MSEC(36));
+    TypedRadioPacket<RelayedPayload<AuthenticatedPayload<MagicPathRadioPacket>>> p;
+    p.header.type = kMagicPathAuthenticatedBeaconType;
+    p.payload.hops = 0;
+    auto& authenticated = p.payload.payload;
+    RfProfile profile;
+    {
+      ScopedMutexLock l(packet_mutex);
+      p.header.address = installation_address.value();
+      authenticated.payload = packet.value();
+      profile = rf_profile.value();
+    }
+    if (!authenticator.Sign(p.header, &authenticated, NextBeaconCounter())) {
+      k_sleep(K_MSEC(kBeaconMacOptions.interval_ms));
+      continue;
+    }
+    // No-op unless profile was changed via Bluetooth.
+    cc1101.SetRfProfile(profile);
+    if (!mac.SendBeacon(p, authenticated.payload.id)) {
+      LOG_DBG("Channel is busy, beacon dropped (%d so far)", mac.GetDroppedCount());
+    }
   }
 }
@@ -0,0 +1,57 @@
+#include "beacon_mac.h"
+
+#include <zephyr/random/random.h>
+
+#include <algorithm>
+
+namespace {
+// Maximal random delay of the beacon in unslotted mode, it's applied in both directions
+// to keep the average interval.
+const uint32_t kJitterMs = 4;
+// Backoff window after the first failed attempt. A beacon is ~0.6 ms on air at 250 kbps.
+const uint32_t kBackoffUnitMs = 1;
+// Backoff window stops growing after that many failed attempts.
+const uint8_t kMaxBackoffExponent = 3;
+}  // namespace
+
+BeaconMac::BeaconMac(Cc1101& cc1101, const Options& options) : cc1101_(cc1101), options_(options) {
+  k_sem_init(&transmitted_, 0, 1);
+  cc1101_.SetTransmitCallback([this](bool sent) {
+    atomic_set(&sent_, sent);
+    k_sem_give(&transmitted_);
+  });
+}
+
+void BeaconMac::WaitForNextBeacon(uint8_t id) {
+  const int64_t now = k_uptime_get();
+  int64_t next;
+  if (options_.num_slots == 0) {
+    if (last_beacon_ < 0) last_beacon_ = now - options_.interval_ms;
+    next = last_beacon_ + options_.interval_ms - kJitterMs + sys_rand32_get() % (2 * kJitterMs + 1);
+    // Don't try to catch up if we were late.
+    last_beacon_ = std::max(next, now);
+  } else {
+    const int64_t frame = now - now % options_.interval_ms;
+    next = frame + (id % options_.num_slots) * (options_.interval_ms / options_.num_slots);
+    // One beacon per frame.
+    if (next < now || frame == last_beacon_) {
+      next += options_.interval_ms;
+      last_beacon_ = frame + options_.interval_ms;
+    } else {
+      last_beacon_ = frame;
+    }
+  }
+
+  if (next > now) k_sleep(K_MSEC(next - now));
+}
+
+void BeaconMac::Backoff(uint8_t attempt) {
+  const uint32_t window = kBackoffUnitMs << std::min(attempt, kMaxBackoffExponent);
+  k_sleep(K_MSEC(1 + sys_rand32_get() % window));
+}
+
+bool BeaconMac::AwaitTransmitted() {
+  // Radio reports every queued packet, sent or not.
+  k_sem_take(&transmitted_, K_FOREVER);
+  return atomic_get(&sent_);
+}
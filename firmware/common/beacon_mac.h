@@ -0,0 +1,62 @@
+#pragma once
+
+#include <zephyr/kernel.h>
+
+#include "cc1101.h"
+
+// Medium access for transmitters periodically sending beacons on a shared channel
+// (e.g. activators, there can be dozens of them in one installation).
+// - Listen-before-talk: beacon is only sent if the channel is clear (see Cc1101::QueueTransmit),
+//   otherwise transmitter backs off for a random time (binary exponential) and tries again.
+//   BeaconMac takes over the transmit callback of the radio to learn the outcome.
+// - Slotted mode (optional): beacon interval is split into num_slots slots and every transmitter
+//   sends in the slot selected by its ID. Slots are relative to the local uptime, so this only
+//   separates transmitters which were powered on together (typically by one switch), otherwise
+//   ones which happen to share a slot collide on every beacon. In unslotted mode (the right
+//   default without time sync) each beacon is randomly jittered instead, so two transmitters
+//   can't stay in lockstep.
+class BeaconMac {
+ public:
+  struct Options {
+    uint32_t interval_ms;
+    // 0 disables slotted mode.
+    uint8_t num_slots = 0;
+    // How many times to try before giving up on the beacon.
+    uint8_t max_attempts = 4;
+  };
+
+  BeaconMac(Cc1101& cc1101, const Options& options);
+
+  // Sleeps until it's time for the next beacon of the transmitter with the given ID and sends it.
+  // Returns false if the channel stayed busy for all the attempts.
+  template <typename RadioPacketT>
+  bool SendBeacon(const RadioPacketT& packet, uint8_t id) {
+    WaitForNextBeacon(id);
+    for (uint8_t attempt = 0; attempt < options_.max_attempts; ++attempt) {
+      if (cc1101_.QueueTransmit(packet) && AwaitTransmitted()) return true;
+      ++busy_channel_count_;
+      Backoff(attempt);
+    }
+    ++dropped_count_;
+    return false;
+  }
+
+  // Statistics, to tune the options for an installation.
+  uint32_t GetBusyChannelCount() const { return busy_channel_count_; }
+  uint32_t GetDroppedCount() const { return dropped_count_; }
+
+ private:
+  void WaitForNextBeacon(uint8_t id);
+  void Backoff(uint8_t attempt);
+  // Waits for the transmit callback, returns whether the beacon was sent.
+  bool AwaitTransmitted();
+
+  Cc1101& cc1101_;
+  const Options options_;
+  // When the last beacon was scheduled (start of its frame in slotted mode).
+  int64_t last_beacon_ = -1;
+  k_sem transmitted_;
+  atomic_t sent_ = 0;
+  uint32_t busy_channel_count_ = 0;
+  uint32_t dropped_count_ = 0;
+};
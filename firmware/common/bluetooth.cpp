@@ -18,6 +18,11 @@ static const bt_data ad[] = {
     BT_DATA(BT_DATA_UUID128_SOME, firefly_service_uuid.val, sizeof(firefly_service_uuid.val))
 };
 
+static const bt_data* scan_response = nullptr;
+static size_t scan_response_len = 0;
+static bool advertising = false;
+static bt_le_adv_param advertising_params;
+
 bt_le_adv_param ConnectableSlowAdvertisingParams() {
   return {
     .id = 0,
@@ -45,15 +50,46 @@ void InitBleAdvertising(const bt_le_adv_param& params) {
 
   LOG_INF("Bluetooth initialized");
 
-  err = bt_le_adv_start(&params, ad, ARRAY_SIZE(ad), nullptr, 0);
+  advertising_params = params;
+  ResumeBleAdvertising();
+}
+
+void ResumeBleAdvertising() {
+  if (advertising) return;
+  auto err = bt_le_adv_start(&advertising_params, ad, ARRAY_SIZE(ad), scan_response, scan_response_len);
   if (err) {
     LOG_ERR("Advertising failed to start (err %d)", err);
     return;
   }
+  advertising = true;
 
   LOG_INF("Advertising successfully started");
 }
 
+void StopBleAdvertising() {
+  if (!advertising) return;
+  auto err = bt_le_adv_stop();
+  if (err) {
+    LOG_ERR("Failed to stop advertising (err %d)", err);
+  }
+  advertising = false;
+  bt_conn_foreach(BT_CONN_TYPE_LE, [](bt_conn* conn, void*) {
+    bt_conn_disconnect(conn, BT_HCI_ERR_REMOTE_POWER_OFF);
+  }, nullptr);
+  LOG_INF("Advertising stopped");
+}
+
+void SetBleScanResponse(const bt_data* sd, size_t sd_len) {
+  scan_response = sd;
+  scan_response_len = sd_len;
+  if (!advertising) return;
+
+  auto err = bt_le_adv_update_data(ad, ARRAY_SIZE(ad), scan_response, scan_response_len);
+  if (err) {
+    LOG_ERR("Failed to update scan response (err %d)", err);
+  }
+}
+
 void SetBatteryLevel(uint8_t level) {
   bt_bas_set_battery_level(level);
 }
\ No newline at end of file
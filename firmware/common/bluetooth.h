@@ -15,6 +15,15 @@ bt_le_adv_param ConnectableFastAdvertisingParams();
 // Use helpers above to create params.
 void InitBleAdvertising(const bt_le_adv_param& params);
 
+// Sets device-specific scan response data, before or after InitBleAdvertising.
+// Data must stay alive while advertising. Call again after changing it.
+void SetBleScanResponse(const bt_data* sd, size_t sd_len);
+
+// Stops advertising and drops all connections, e.g. to save power.
+void StopBleAdvertising();
+// Restarts advertising stopped by StopBleAdvertising, with the params passed to InitBleAdvertising.
+void ResumeBleAdvertising();
+
 void SetBatteryLevel(uint8_t level);
 
 
@@ -1,7 +1,7 @@
 #pragma once
 #include <zephyr/device.h>
 
-#include "timer.h"
+#include "frame_scheduler.h"
 
 class Buzzer {
 public:
@@ -11,6 +11,6 @@ private:
   void Silence();
 
   const device* device_ = DEVICE_DT_GET(DT_PWMS_CTLR(DT_ALIAS(buzzer)));
-  Timer t_{ [this](){ Silence(); } };
+  FrameScheduler::Effect t_{ [this](){ Silence(); } };
 };
 
@@ -1,13 +1,161 @@
 #include "cc1101.h"
 
+#include <array>
+#include <cerrno>
+
 LOG_MODULE_DECLARE();
 
+namespace {
+// Values of all configuration registers (CC_IOCFG2 to CC_TEST0) for the given RF profile, indexed by register
+// address. Registers which are not mentioned in cc1101_rf_settings.h are set to their reset values.
+constexpr std::array<uint8_t, CC_TEST0 + 1> MakeRfConfigTable(const Cc1101RfProfileSettings& profile) {
+  const auto& modem = profile.modem;
+  std::array<uint8_t, CC_TEST0 + 1> t{};
+  t[CC_IOCFG2] = CC_IOCFG2_VALUE;      // GDO2 output pin configuration.
+  t[CC_IOCFG1] = 0x2E;                 // GDO1 output pin configuration (reset value, high impedance).
+  t[CC_IOCFG0] = CC_IOCFG0_VALUE;      // GDO0 output pin configuration.
+  t[CC_FIFOTHR] = CC_FIFOTHR_VALUE;    // fifo threshold
+  t[CC_SYNC1] = CC_SYNC1_VALUE;        // Sync word, high byte.
+  t[CC_SYNC0] = CC_SYNC0_VALUE;        // Sync word, low byte.
+  t[CC_PKTLEN] = 0xFF;                 // Packet length (reset value, overwritten by SetPacketSize).
+  t[CC_PKTCTRL1] = CC_PKTCTRL1_VALUE;  // Packet automation control.
+  t[CC_PKTCTRL0] = CC_PKTCTRL0_VALUE;  // Packet automation control.
+  t[CC_ADDR] = 0x00;                   // Device address (reset value, address check is disabled).
+  t[CC_CHANNR] = CC_CHANNR_VALUE;      // Channel number.
+  t[CC_FSCTRL1] = modem.fsctrl1;       // Frequency synthesizer control.
+  t[CC_FSCTRL0] = CC_FSCTRL0_VALUE;    // Frequency synthesizer control.
+  t[CC_FREQ2] = CC_FREQ2_VALUE;        // Frequency control word, high byte.
+  t[CC_FREQ1] = CC_FREQ1_VALUE;        // Frequency control word, middle byte.
+  t[CC_FREQ0] = CC_FREQ0_VALUE;        // Frequency control word, low byte.
+  t[CC_MDMCFG4] = modem.mdmcfg4;       // Modem configuration.
+  t[CC_MDMCFG3] = modem.mdmcfg3;       // Modem configuration.
+  t[CC_MDMCFG2] = modem.mdmcfg2;       // Modem configuration.
+  // Modem configuration: FEC_EN, NUM_PREAMBLE, CHANSPC_E.
+  t[CC_MDMCFG1] = (profile.fec ? 0x80 : 0x00) | NumPreambleField(profile.preamble_bytes) | CC_CHANSPC_E;
+  t[CC_MDMCFG0] = CC_MDMCFG0_VALUE;    // Modem configuration.
+  t[CC_DEVIATN] = modem.deviatn;       // Modem deviation setting (when FSK modulation is enabled).
+  t[CC_MCSM2] = CC_MCSM2_VALUE;        // Main Radio Control State Machine configuration.
+  t[CC_MCSM1] = CC_MCSM1_VALUE;        // Main Radio Control State Machine configuration.
+  t[CC_MCSM0] = CC_MCSM0_VALUE;        // Main Radio Control State Machine configuration.
+  t[CC_FOCCFG] = modem.foccfg;         // Frequency Offset Compensation Configuration.
+  t[CC_BSCFG] = modem.bscfg;           // Bit synchronization Configuration.
+  t[CC_AGCCTRL2] = modem.agcctrl2;     // AGC control.
+  t[CC_AGCCTRL1] = modem.agcctrl1;     // AGC control.
+  t[CC_AGCCTRL0] = modem.agcctrl0;     // AGC control.
+  t[CC_WOREVT1] = 0x87;                // Wake On Radio event timeout, high byte (reset value).
+  t[CC_WOREVT0] = 0x6B;                // Wake On Radio event timeout, low byte (reset value).
+  t[CC_WORCTRL] = 0xF8;                // Wake On Radio control (reset value).
+  t[CC_FREND1] = modem.frend1;         // Front end RX configuration.
+  t[CC_FREND0] = CC_FREND0_VALUE;      // Front end TX configuration.
+  t[CC_FSCAL3] = modem.fscal3;         // Frequency synthesizer calibration.
+  t[CC_FSCAL2] = CC_FSCAL2_VALUE;      // Frequency synthesizer calibration.
+  t[CC_FSCAL1] = CC_FSCAL1_VALUE;      // Frequency synthesizer calibration.
+  t[CC_FSCAL0] = CC_FSCAL0_VALUE;      // Frequency synthesizer calibration.
+  t[CC_RCCTRL1] = 0x41;                // RC oscillator configuration (reset value).
+  t[CC_RCCTRL0] = 0x00;                // RC oscillator configuration (reset value).
+  t[CC_FSTEST] = 0x59;                 // }
+  t[CC_PTEST] = 0x7F;                  // }
+  t[CC_AGCTEST] = 0x3F;                // } Test only, never written.
+  t[CC_TEST2] = modem.test2;           // Various test settings.
+  t[CC_TEST1] = modem.test1;           // Various test settings.
+  t[CC_TEST0] = modem.test0;           // Various test settings.
+  return t;
+}
+
+constexpr auto kRfConfigTables = [] {
+  std::array<std::array<uint8_t, CC_TEST0 + 1>, kRfProfileCount> tables{};
+  for (size_t i = 0; i < kRfProfileCount; ++i) tables[i] = MakeRfConfigTable(kRfProfiles[i]);
+  return tables;
+}();
+
+static_assert([] {
+  for (const auto& profile : kRfProfiles) {
+    if (NumPreambleField(profile.preamble_bytes) == kInvalidNumPreamble) return false;
+  }
+  return true;
+}(), "Unsupported preamble length in RF profile");
+
+// Registers which don't depend on the profile (IOCFG, MCSM, WOR, ...) are the same in all the tables.
+constexpr const auto& kRfConfigTable = kRfConfigTables[static_cast<size_t>(RfProfile::kDefault)];
+
+// Registers which depend on the RF profile are in [kFirstProfileRegister, kLastProfileRegister] and
+// [CC_TEST2, CC_TEST0]. Profile-independent registers in the first range keep their table values
+// unless radio is in async mode (see SetRfProfile), so uploading them again is harmless.
+constexpr uint8_t kFirstProfileRegister = CC_FSCTRL1;
+constexpr uint8_t kLastProfileRegister = CC_FSCAL0;
+static_assert([] {
+  for (uint8_t reg = 0; reg <= CC_TEST0; ++reg) {
+    if ((reg >= kFirstProfileRegister && reg <= kLastProfileRegister) || reg >= CC_TEST2) continue;
+    for (const auto& table : kRfConfigTables) {
+      if (table[reg] != kRfConfigTable[reg]) return false;
+    }
+  }
+  return true;
+}(), "Profile-dependent register outside of the uploaded ranges");
+
+#if DT_NODE_EXISTS(DT_ALIAS(cc1101_miso))
+const gpio_dt_spec miso_spec = GPIO_DT_SPEC_GET(DT_ALIAS(cc1101_miso), gpios);
+const gpio_dt_spec cs_spec = SPI_CS_GPIOS_DT_SPEC_GET(DT_ALIAS(cc1101));
+#endif
+
+// Upper bound for CC1101 to become ready after reset. Datasheet doesn't specify it,
+// but it's dominated by crystal oscillator startup which is ~150us.
+const uint32_t kReadyTimeoutUs = 5000;
+
+// Upper bound for the frequency synthesizer calibration, which normally takes ~720us.
+const uint32_t kCalibrationTimeoutUs = 2000;
+
+// WOR Event 0 timeout is 750 / f_xosc * EVENT0 (for WOR_RES = 0), see datasheet p.53, 19.5.
+// With 27 MHz crystal that's 36 EVENT0 ticks per millisecond.
+const uint32_t kWorEvent0TicksPerMs = 27000 / 750;
+static_assert(Cc1101::kMaxWorPeriodMs * kWorEvent0TicksPerMs <= 0xFFFF);
+
+// WORCTRL: RC oscillator enabled (RC_PD = 0), EVENT1 = 7 (~1.3 ms for the crystal to settle),
+// RC oscillator calibration enabled, WOR_RES = 0.
+const uint8_t kWorCtrlValue = 0x78;
+
+// MCSM1 with RXOFF_MODE = RX: stay in RX after a packet is received.
+const uint8_t kMcsm1StayInRx = CC_MCSM1_VALUE | 0b00001100;
+
+// MCSM1 with CCA_MODE = 11: STX in RX only enters TX if RSSI is below threshold
+// and no packet is being received.
+const uint8_t kMcsm1ClearChannelCheck = CC_MCSM1_VALUE | 0b00110000;
+// Same for the transmit queue, plus RXOFF_MODE = RX: a packet heard while listening doesn't
+// leave radio in IDLE, where STX would send without the check.
+const uint8_t kMcsm1QueuedTx = kMcsm1ClearChannelCheck | 0b00001100;
+// PKTSTATUS.CCA bit.
+const uint8_t kPktStatusCca = 0x10;
+
+// Size of the TX FIFO, the packet on air and the preloaded one must fit in it together.
+const size_t kTxFifoBytes = 64;
+
+// RXBYTES.RXFIFO_OVERFLOW bit.
+const uint8_t kRxFifoOverflow = 0x80;
+
+// PKTCTRL1.CRC_AUTOFLUSH bit.
+const uint8_t kCrcAutoflush = 0b00001000;
+// MDMCFG1.FEC_EN bit.
+const uint8_t kFecEnabled = 0x80;
+
+// CRC_OK bit of the second appended status byte (LQI).
+const uint8_t kCrcOk = 0x80;
+
+// IOCFG0.GDO0_CFG = 7: asserts when a packet has been received with CRC OK.
+// De-asserts when the first byte is read from the RX FIFO.
+const uint8_t kIoCfgPacketWithCrcOk = 0x07;
+}
+
 const device* Cc1101::spi_ = DEVICE_DT_GET(DT_ALIAS(cc1101_spi));
 
 const gpio_dt_spec gpio_device_spec = GPIO_DT_SPEC_GET(DT_ALIAS(cc1101_gdo0), gpios);
 
 k_sem Cc1101::gd_ready_;
 gpio_callback Cc1101::gdo0_callback_data_;
+Cc1101* Cc1101::instance_ = nullptr;
+char Cc1101::rx_queue_buffer_[kAsyncQueueDepth * sizeof(ReceivedPacket)];
+k_msgq Cc1101::rx_queue_;
+char Cc1101::tx_queue_buffer_[kTxQueueDepth * sizeof(OutgoingPacket)];
+k_msgq Cc1101::tx_queue_;
 
 spi_config Cc1101::spi_config_ = {
     .frequency = 0x400000UL,  // 4 MHz
@@ -25,22 +173,29 @@ spi_config Cc1101::spi_config_ = {
 
 void Cc1101::Init() {
   k_sem_init(&gd_ready_, 0, 1);
-
+  k_msgq_init(&rx_queue_, rx_queue_buffer_, sizeof(ReceivedPacket), kAsyncQueueDepth);
+  k_work_init(&rx_work_, RxWorkHandler);
+  k_msgq_init(&tx_queue_, tx_queue_buffer_, sizeof(OutgoingPacket), kTxQueueDepth);
+  k_work_init(&tx_work_, TxWorkHandler);
+  instance_ = this;
+
+  const uint32_t start_cycles = k_cycle_get_32();
+  shadow_valid_ = false;
+  // Reset wakes radio up anyway, and all the configuration is uploaded below.
+  asleep_ = false;
+  packet_length_ = PacketLength::kFixed;
+  rx_pending_length_ = 0;
+  InvalidateCalibration();
   Reset();
-
-  // TODO(aeremin) This is a hack. Instead we should wait for
-  // CC1101 to became ready by listening for MISO to become low.
-  // This actually should be done every time we initiate a transfer (i.e. pull CS low),
-  // but there is no direct support for that in nRF SPI library. From the datasheet it
-  // seems that it's actually only required when leaving SLEEP or XOFF states
-  // (see p. 29, "4-wire Serial Configuration and Data Interface").
-  k_sleep(K_MSEC(40));
+  if (!WaitUntilReady()) LOG_ERR("CC1101 is not ready after reset");
 
   RfConfig();
   FlushRxFIFO();
 
+  // Channel is already set to CC_CHANNR_VALUE by RfConfig.
   SetTxPower(CC_PwrMinus30dBm);
-  SetChannel(0);
+  shadow_valid_ = true;
+  LOG_INF("CC1101 initialized in %u us", k_cyc_to_us_floor32(k_cycle_get_32() - start_cycles));
 
 	auto ret = gpio_pin_configure_dt(&gpio_device_spec, GPIO_INPUT);
 	if (ret != 0) LOG_ERR("Failed to configure button pin: %d", ret);
@@ -54,10 +209,329 @@ void Cc1101::Init() {
 
 void Cc1101::Gdo0Callback(const device *dev, gpio_callback *cb, gpio_port_pins_t pins)
 {
-   k_sem_give(&Cc1101::gd_ready_);
+  // We are in the interrupt context here, so SPI transfers are not allowed.
+  // In async mode, read out the packet from the workqueue thread instead.
+  const auto mode = instance_ ? atomic_get(&instance_->async_mode_) : kAsyncOff;
+  if (mode == kAsyncTx) {
+    atomic_set(&instance_->tx_done_, 1);
+    k_work_submit(&instance_->tx_work_);
+  } else if (mode != kAsyncOff) {
+    k_work_submit(&instance_->rx_work_);
+  } else {
+    k_sem_give(&Cc1101::gd_ready_);
+  }
+}
+
+void Cc1101::RxWorkHandler(k_work* work) {
+  auto* self = CONTAINER_OF(work, Cc1101, rx_work_);
+  const auto mode = atomic_get(&self->async_mode_);
+  if (mode == kAsyncOff) return;
+
+  self->DrainRxFifo();
+  if (mode == kAsyncWor) self->SwitchWorToRx();
+}
+
+void Cc1101::DrainRxFifo() {
+  uint8_t entry[kMaxPacketSize + 2];
+
+  while (true) {
+    uint8_t rx_bytes = ReadVolatileStatusRegister(CC_RXBYTES);
+    if (rx_bytes & kRxFifoOverflow) {
+      LOG_WRN("RX FIFO overflow, flushing");
+      EnterIdle();
+      FlushRxFIFO();
+      rx_pending_length_ = 0;
+      EnterRX();
+      return;
+    }
+
+    size_t packet_size = async_packet_size_;
+    if (packet_length_ == PacketLength::kVariable) {
+      if (rx_pending_length_ == 0) {
+        if (rx_bytes == 0) return;
+        // Length byte can't be put back, so remember it in case the rest of the packet isn't here yet.
+        ReadFifoBytes(&rx_pending_length_, 1);
+        --rx_bytes;
+        if (rx_pending_length_ == 0 || rx_pending_length_ > kMaxPacketSize) {
+          LOG_WRN("Unexpected packet length %d, flushing", rx_pending_length_);
+          EnterIdle();
+          FlushRxFIFO();
+          rx_pending_length_ = 0;
+          EnterRX();
+          return;
+        }
+      }
+      packet_size = rx_pending_length_;
+    }
+
+    // Every packet in the FIFO is followed by 2 appended status bytes: RSSI and LQI/CRC_OK.
+    const size_t entry_size = packet_size + 2;
+    // Incomplete packet can only follow the complete one, so it's safe to stop here.
+    if (rx_bytes < entry_size) return;
+
+    ReadFifoBytes(entry, entry_size);
+    rx_pending_length_ = 0;
+    if (!(entry[entry_size - 1] & kCrcOk)) continue;
+
+    ReceivedPacket packet;
+    packet.size = packet_size;
+    memcpy(packet.data, entry, packet_size);
+    packet.rssi = entry[entry_size - 2];
+    packet.lqi_and_crc_ok = entry[entry_size - 1];
+    if (k_msgq_put(&rx_queue_, &packet, K_NO_WAIT) != 0) {
+      LOG_WRN("Async receive queue is full, dropping packet");
+    }
+  }
+}
+
+bool Cc1101::TransmitIfChannelClear(const void* packet, size_t size) {
+  SetTxPacketSize(size);
+  Recalibrate();
+  FlushTxFIFO();
+  WriteConfigurationRegister(CC_MCSM1, kMcsm1ClearChannelCheck);
+  EnterRX();
+  SettleCarrierSense();
+
+  bool clear = ReadRegister(CC_PKTSTATUS) & kPktStatusCca;
+  if (clear) {
+    WriteFifoBytes(static_cast<const uint8_t*>(packet), size);
+    // GDO0 could have fired if sync word was heard while we were listening.
+    k_sem_reset(&gd_ready_);
+    EnterTX();
+    // Channel could become busy in the meantime, then radio stays in RX.
+    const uint8_t state = ReadRegister(CC_MARCSTATE) & 0x1F;
+    clear = state == CC_ST_RXTX_SETTLING || state == CC_ST_TX19 || state == CC_ST_TX20;
+    if (clear) k_sem_take(&gd_ready_, K_FOREVER);
+  }
+
+  if (!clear) {
+    EnterIdle();
+    FlushTxFIFO();
+  }
+  WriteConfigurationRegister(CC_MCSM1, kRfConfigTable[CC_MCSM1]);
+  if (auto_sleep_) Sleep();
+  return clear;
+}
+
+void Cc1101::SettleCarrierSense() {
+  const uint32_t start = k_cycle_get_32();
+  while ((ReadRegister(CC_MARCSTATE) & 0x1F) < CC_ST_RX13) {
+    if (k_cyc_to_us_floor32(k_cycle_get_32() - start) > kCalibrationTimeoutUs) break;
+  }
+  k_busy_wait(GetRfProfileSettings(profile_).carrier_sense_settle_us);
+}
+
+bool Cc1101::QueueTransmit(const void* packet, size_t size) {
+  const auto mode = atomic_get(&async_mode_);
+  if (mode == kAsyncRx || mode == kAsyncWor) {
+    LOG_WRN("QueueTransmit: radio is busy receiving");
+    return false;
+  }
+
+  OutgoingPacket outgoing;
+  outgoing.size = size;
+  memcpy(outgoing.data, packet, size);
+  if (k_msgq_put(&tx_queue_, &outgoing, K_NO_WAIT) != 0) return false;
+  // All SPI traffic happens in the workqueue, so nothing races with the packet on air.
+  k_work_submit(&tx_work_);
+  return true;
+}
+
+void Cc1101::TxWorkHandler(k_work* work) {
+  CONTAINER_OF(work, Cc1101, tx_work_)->PumpTxQueue();
+}
+
+void Cc1101::PumpTxQueue() {
+  if (tx_on_air_size_ != 0) {
+    if (!atomic_cas(&tx_done_, 1, 0)) {
+      // Packet was queued while another one is on air.
+      if (tx_preloaded_size_ == 0) PreloadNextTx();
+      return;
+    }
+    // Radio is in IDLE already (TXOFF_MODE).
+    tx_on_air_size_ = 0;
+    if (on_transmitted_) on_transmitted_(true);
+  }
+
+  while (tx_preloaded_size_ != 0 || PreloadNextTx()) {
+    if (StartPreloadedTx()) {
+      PreloadNextTx();
+      return;
+    }
+    if (on_transmitted_) on_transmitted_(false);
+  }
+
+  if (atomic_get(&async_mode_) == kAsyncTx) {
+    // Queue is drained.
+    atomic_set(&async_mode_, kAsyncOff);
+    WriteConfigurationRegister(CC_MCSM1, kRfConfigTable[CC_MCSM1]);
+    if (auto_sleep_) Sleep();
+  }
+}
+
+bool Cc1101::PreloadNextTx() {
+  OutgoingPacket packet;
+  if (k_msgq_peek(&tx_queue_, &packet) != 0) return false;
+  if (tx_on_air_size_ != 0) {
+    const size_t length_bytes = packet_length_ == PacketLength::kVariable ? 2 : 0;
+    if (tx_on_air_size_ + packet.size + length_bytes > kTxFifoBytes) return false;
+    // PKTLEN can't be changed while the previous packet is on air.
+    if (packet_length_ == PacketLength::kFixed && packet.size != shadow_[CC_PKTLEN]) return false;
+  }
+  k_msgq_get(&tx_queue_, &packet, K_NO_WAIT);
+
+  if (atomic_get(&async_mode_) != kAsyncTx) {
+    // Queue is starting from IDLE (or SLEEP).
+    WriteConfigurationRegister(CC_MCSM1, kMcsm1QueuedTx);
+    atomic_set(&async_mode_, kAsyncTx);
+  }
+  if (tx_on_air_size_ == 0) {
+    SetTxPacketSize(packet.size);
+    FlushTxFIFO();
+  }
+  WriteFifoBytes(packet.data, packet.size);
+  tx_preloaded_size_ = packet.size;
+  return true;
+}
+
+bool Cc1101::StartPreloadedTx() {
+  const uint8_t size = tx_preloaded_size_;
+  tx_preloaded_size_ = 0;
+  Recalibrate();
+  // Could be left over from a packet heard while listening for the previous one.
+  FlushRxFIFO();
+  EnterRX();
+  SettleCarrierSense();
+  // With CCA_MODE = 11 STX is ignored unless the channel is clear.
+  EnterTX();
+  const uint8_t state = ReadRegister(CC_MARCSTATE) & 0x1F;
+  if (state >= CC_ST_RX13 && state <= CC_ST_RX15) {
+    EnterIdle();
+    FlushTxFIFO();
+    return false;
+  }
+  // GDO0 could have fired for a packet heard while listening. Unless TX is over already,
+  // the edge of our packet is still to come.
+  if (state != CC_ST_IDLE) atomic_set(&tx_done_, 0);
+  tx_on_air_size_ = size;
+  return true;
+}
+
+void Cc1101::StartReceive(uint8_t packet_size) {
+  if (packet_size > kMaxPacketSize) {
+    LOG_ERR("Packet size %d is too big", packet_size);
+    return;
+  }
+  SetPacketSize(packet_size);
+  async_packet_size_ = packet_size;
+  ArmAsyncRx();
+}
+
+void Cc1101::StartWakeOnRadio(uint8_t packet_size, uint32_t period_ms, WorRxTime rx_time) {
+  if (packet_size > kMaxPacketSize) {
+    LOG_ERR("Packet size %d is too big", packet_size);
+    return;
+  }
+  SetPacketSize(packet_size);
+  async_packet_size_ = packet_size;
+  ArmWakeOnRadio(period_ms, rx_time);
+}
+
+bool Cc1101::AwaitRawPacket(uint32_t timeout_ms, RawReceivedPacket* result) {
+  ReceivedPacket packet;
+  if (k_msgq_get(&rx_queue_, &packet, K_MSEC(timeout_ms)) != 0) return false;
+  result->size = packet.size;
+  memcpy(result->data, packet.data, packet.size);
+  result->rssi_dbm = RssiToDbm(packet.rssi);
+  result->lqi = packet.lqi_and_crc_ok & 0x7F;
+  result->crc_ok = packet.lqi_and_crc_ok & kCrcOk;
+  return true;
+}
+
+void Cc1101::ArmAsyncRx() {
+  Recalibrate();
+  EnableCrcOkInterrupt();
+  FlushRxFIFO();
+  rx_pending_length_ = 0;
+  WriteConfigurationRegister(CC_MCSM1, kMcsm1StayInRx);
+  atomic_set(&async_mode_, kAsyncRx);
+  ApplyCrcAutoflush();
+  EnterRX();
+}
+
+void Cc1101::EnableCrcOkInterrupt() {
+  // Only raise GDO0 when packet with good CRC (and matching address, see SetAddressFilter) is
+  // received, not on every sync word (which would also wake us up for packets dropped later).
+  WriteConfigurationRegister(CC_IOCFG0, kIoCfgPacketWithCrcOk);
+  gpio_pin_interrupt_configure_dt(&gpio_device_spec, GPIO_INT_EDGE_RISING);
+}
+
+void Cc1101::ArmWakeOnRadio(uint32_t period_ms, WorRxTime rx_time) {
+  if (period_ms > kMaxWorPeriodMs) {
+    LOG_WRN("WOR period %d ms is too long, using %d ms", period_ms, kMaxWorPeriodMs);
+    period_ms = kMaxWorPeriodMs;
+  }
+  const uint16_t event0 = period_ms * kWorEvent0TicksPerMs;
+
+  Recalibrate();
+  WriteConfigurationRegister(CC_WOREVT1, event0 >> 8);
+  WriteConfigurationRegister(CC_WOREVT0, event0 & 0xFF);
+  WriteConfigurationRegister(CC_WORCTRL, kWorCtrlValue);
+  WriteConfigurationRegister(CC_MCSM2, static_cast<uint8_t>(rx_time));
+  EnableCrcOkInterrupt();
+
+  FlushRxFIFO();
+  rx_pending_length_ = 0;
+  atomic_set(&async_mode_, kAsyncWor);
+  ApplyCrcAutoflush();
+  wor_armed_ = true;
+  EnterWor();
+}
+
+void Cc1101::LeaveWakeOnRadio() {
+  if (!wor_armed_) return;
+  wor_armed_ = false;
+  // Otherwise the shadow suppresses writes of the table values, and the radio (including
+  // the calibration, see Recalibrate) keeps running with the reset TEST values.
+  RestoreRegistersLostInSleep();
+  // Calibration could have run with those too.
+  WriteConfigurationRegisters(CC_FSCAL3, &shadow_[CC_FSCAL3], CC_FSCAL1 - CC_FSCAL3 + 1);
+}
+
+void Cc1101::SwitchWorToRx() {
+  // After the packet radio went to IDLE (RXOFF_MODE = IDLE), so it's safe to reconfigure.
+  EnterIdle();
+  LeaveWakeOnRadio();
+  WriteConfigurationRegister(CC_MCSM2, kRfConfigTable[CC_MCSM2]);
+  FlushRxFIFO();
+  rx_pending_length_ = 0;
+  WriteConfigurationRegister(CC_MCSM1, kMcsm1StayInRx);
+  atomic_set(&async_mode_, kAsyncRx);
+  EnterRX();
+}
+
+void Cc1101::StopReceive() {
+  atomic_set(&async_mode_, kAsyncOff);
+  // Wait for the work handler, it could be reconfiguring the radio right now.
+  k_work_sync sync;
+  k_work_cancel_sync(&rx_work_, &sync);
+  EnterIdle();
+  LeaveWakeOnRadio();
+
+  // Restore everything ArmAsyncRx/ArmWakeOnRadio could have changed.
+  // Thanks to the register shadow, that's free if nothing was changed.
+  WriteConfigurationRegister(CC_MCSM1, kRfConfigTable[CC_MCSM1]);
+  WriteConfigurationRegister(CC_MCSM2, kRfConfigTable[CC_MCSM2]);
+  WriteConfigurationRegister(CC_WORCTRL, kRfConfigTable[CC_WORCTRL]);
+  ApplyCrcAutoflush();
+  if (shadow_[CC_IOCFG0] != kRfConfigTable[CC_IOCFG0]) {
+    WriteConfigurationRegister(CC_IOCFG0, kRfConfigTable[CC_IOCFG0]);
+    gpio_pin_interrupt_configure_dt(&gpio_device_spec, GPIO_INT_EDGE_FALLING);
+  }
 }
 
 void Cc1101::WriteStrobe(uint8_t instruction, uint8_t* status /* = nullptr*/) {
+  EnsureAwake();
   spi_buf tx_buf = {
       .buf = &instruction,
       .len = 1};
@@ -81,6 +555,21 @@ void Cc1101::WriteStrobe(uint8_t instruction, uint8_t* status /* = nullptr*/) {
 }
 
 void Cc1101::WriteConfigurationRegister(uint8_t reg, uint8_t value, uint8_t* statuses /* = nullptr*/) {
+  EnsureAwake();
+  uint8_t* shadow = nullptr;
+  if (reg <= CC_TEST0) {
+    shadow = &shadow_[reg];
+  } else if (reg == CC_PATABLE) {
+    shadow = &patable_shadow_;
+  }
+
+  if (shadow_valid_ && shadow && *shadow == value && !statuses) {
+    ++suppressed_register_writes_;
+    return;
+  }
+  ++register_writes_;
+  if (shadow) *shadow = value;
+
   uint8_t tx[] = {reg, value};
   spi_buf tx_buf = {
       .buf = tx,
@@ -104,7 +593,55 @@ void Cc1101::WriteConfigurationRegister(uint8_t reg, uint8_t value, uint8_t* sta
   }
 }
 
+void Cc1101::WriteConfigurationRegisters(uint8_t first_reg, const uint8_t* values, size_t count) {
+  EnsureAwake();
+  uint8_t header = first_reg | CC_WRITE_FLAG | CC_BURST_FLAG;
+
+  spi_buf tx_bufs[2];
+
+  tx_bufs[0].buf = &header;
+  tx_bufs[0].len = 1;
+
+  tx_bufs[1].buf = const_cast<uint8_t*>(values);
+  tx_bufs[1].len = count;
+
+  spi_buf_set tx_bufs_set = {
+      .buffers = tx_bufs,
+      .count = 2};
+
+  auto r = TransferBurst(&tx_bufs_set, nullptr);
+  if (r != 0) {
+    LOG_ERR("WriteConfigurationRegisters fail: %d", r);
+  }
+
+  ++register_writes_;
+  for (size_t i = 0; i < count && first_reg + i <= CC_TEST0; ++i) {
+    shadow_[first_reg + i] = values[i];
+  }
+}
+
+bool Cc1101::WaitUntilReady() {
+#if DT_NODE_EXISTS(DT_ALIAS(cc1101_miso))
+  // CC1101 keeps SO (MISO) high while CSn is low until its crystal oscillator
+  // is running. SPI driver only touches CSn during transfers, so we can drive
+  // it manually and sample MISO as a regular GPIO input.
+  gpio_pin_set_dt(&cs_spec, 1);
+  const uint32_t start = k_cycle_get_32();
+  bool ready = false;
+  while (!(ready = gpio_pin_get_dt(&miso_spec) == 0) &&
+         k_cyc_to_us_floor32(k_cycle_get_32() - start) < kReadyTimeoutUs) {
+  }
+  gpio_pin_set_dt(&cs_spec, 0);
+  return ready;
+#else
+  // No way to sample MISO on this board, just wait long enough.
+  k_sleep(K_MSEC(40));
+  return true;
+#endif
+}
+
 uint8_t Cc1101::ReadRegister(uint8_t reg, uint8_t* status /* = nullptr*/) {
+  EnsureAwake();
   uint8_t tx = reg | CC_READ_FLAG;
   uint8_t rx[] = {0, 0};
 
@@ -133,47 +670,252 @@ uint8_t Cc1101::ReadRegister(uint8_t reg, uint8_t* status /* = nullptr*/) {
   return rx[1];
 }
 
+bool Cc1101::ReadFifo(void* result, size_t size) {
+  if (size > kMaxPacketSize) {
+    LOG_ERR("ReadFifo: packet of size %zu is too big", size);
+    return false;
+  }
+
+  uint8_t status = 0;
+  uint8_t b = ReadRegister(CC_PKTSTATUS, &status);
+  if (!(b & 0x80)) {
+    LOG_WRN("Weird, no data, packet status = %d, read register status =%d", b, status);
+    return false;
+  } else {
+    LOG_DBG("CRC OK, packet status = %d, read register status =%d", b, status);
+  }
+  // Payload and 2 appended status bytes (RSSI and LQI).
+  uint8_t rx[kMaxPacketSize + 2];
+  if (packet_length_ == PacketLength::kVariable) {
+    uint8_t length = 0;
+    ReadFifoBytes(&length, 1);
+    if (length != size) {
+      // PKTLEN only filters out longer packets.
+      LOG_WRN("ReadFifo: unexpected packet length %d", length);
+      EnterIdle();
+      FlushRxFIFO();
+      return false;
+    }
+  }
+  ReadFifoBytes(rx, size + 2);
+  memcpy(result, rx, size);
+  return true;
+}
+
+void Cc1101::WriteFifoBytes(const uint8_t* data, size_t count) {
+  EnsureAwake();
+  uint8_t header = CC_FIFO | CC_WRITE_FLAG | CC_BURST_FLAG;
+  uint8_t length = count;
+
+  spi_buf tx_bufs[3];
+
+  tx_bufs[0].buf = &header;
+  tx_bufs[0].len = 1;
+
+  tx_bufs[1].buf = &length;
+  tx_bufs[1].len = packet_length_ == PacketLength::kVariable ? 1 : 0;
+
+  tx_bufs[2].buf = const_cast<uint8_t*>(data);
+  tx_bufs[2].len = count;
+
+  spi_buf_set tx_bufs_set = {
+      .buffers = tx_bufs,
+      .count = 3};
+
+  auto r = TransferBurst(&tx_bufs_set, nullptr);
+  if (r != 0) {
+    LOG_ERR("WriteFifoBytes fail: %d", r);
+  }
+}
+
+void Cc1101::ReadFifoBytes(uint8_t* result, size_t count) {
+  EnsureAwake();
+  uint8_t tx = CC_FIFO | CC_READ_FLAG | CC_BURST_FLAG;
+
+  spi_buf tx_buf = {
+      .buf = &tx,
+      .len = 1};
+
+  spi_buf_set tx_bufs = {
+      .buffers = &tx_buf,
+      .count = 1};
+
+  // First byte is a chip status byte received while sending the header, skip it.
+  spi_buf rx_buf[2] = {
+      {.buf = nullptr, .len = 1},
+      {.buf = result, .len = count}};
+
+  spi_buf_set rx_bufs = {
+      .buffers = rx_buf,
+      .count = 2};
+
+  auto r = TransferBurst(&tx_bufs, &rx_bufs);
+  if (r != 0) {
+    LOG_ERR("ReadFifoBytes fail: %d", r);
+  }
+}
+
+int Cc1101::TransferBurst(const spi_buf_set* tx_bufs, const spi_buf_set* rx_bufs) {
+#if defined(CONFIG_SPI_ASYNC) && defined(CONFIG_POLL)
+  // Signal can live on the stack as we always wait for the transfer to finish.
+  k_poll_signal done;
+  k_poll_signal_init(&done);
+  auto r = spi_transceive_signal(spi_, &spi_config_, tx_bufs, rx_bufs, &done);
+  // E.g. STM32 driver without CONFIG_SPI_STM32_INTERRUPT.
+  if (r == -ENOTSUP) return spi_transceive(spi_, &spi_config_, tx_bufs, rx_bufs);
+  if (r != 0) return r;
+
+  k_poll_event event = K_POLL_EVENT_INITIALIZER(K_POLL_TYPE_SIGNAL, K_POLL_MODE_NOTIFY_ONLY, &done);
+  k_poll(&event, 1, K_FOREVER);
+  unsigned int signaled;
+  k_poll_signal_check(&done, &signaled, &r);
+  return r;
+#else
+  return spi_transceive(spi_, &spi_config_, tx_bufs, rx_bufs);
+#endif
+}
+
+uint8_t Cc1101::ReadVolatileStatusRegister(uint8_t reg) {
+  uint8_t previous = ReadRegister(reg);
+  while (true) {
+    const uint8_t current = ReadRegister(reg);
+    if (current == previous) return current;
+    previous = current;
+  }
+}
+
 void Cc1101::Recalibrate() {
   EnterIdle();
+
+  const uint8_t channel = shadow_[CC_CHANNR];
+  ChannelCalibration* cached = channel < kCalibratedChannels ? &calibrations_[channel] : nullptr;
+  const int64_t now = k_uptime_get();
+  if (shadow_valid_ && cached && cached->timestamp != 0 && now - cached->timestamp < kCalibrationMaxAgeMs) {
+    // Fast frequency hopping: restore results instead of calibrating again.
+    // Thanks to the register shadow, that's free if we didn't change the channel.
+    const uint8_t fscal[] = {cached->fscal3, cached->fscal2, cached->fscal1};
+    if (memcmp(fscal, &shadow_[CC_FSCAL3], sizeof(fscal)) != 0) {
+      WriteConfigurationRegisters(CC_FSCAL3, fscal, sizeof(fscal));
+    } else {
+      ++suppressed_register_writes_;
+    }
+    return;
+  }
+
   WriteStrobe(CC_SCAL);
+
+  // Calibration takes ~700us, wait for it to finish before reading the results.
+  const uint32_t start = k_cycle_get_32();
+  bool timed_out = false;
+  while ((ReadRegister(CC_MARCSTATE) & 0x1F) != CC_ST_IDLE) {
+    if (k_cyc_to_us_floor32(k_cycle_get_32() - start) > kCalibrationTimeoutUs) {
+      LOG_WRN("Calibration of channel %d timed out", channel);
+      timed_out = true;
+      break;
+    }
+  }
+
+  // Calibration has changed FSCAL registers behind the shadow's back.
+  shadow_[CC_FSCAL3] = ReadRegister(CC_FSCAL3);
+  shadow_[CC_FSCAL2] = ReadRegister(CC_FSCAL2);
+  shadow_[CC_FSCAL1] = ReadRegister(CC_FSCAL1);
+
+  if (cached && !timed_out) {
+    cached->fscal3 = shadow_[CC_FSCAL3];
+    cached->fscal2 = shadow_[CC_FSCAL2];
+    cached->fscal1 = shadow_[CC_FSCAL1];
+    cached->timestamp = now;
+  }
+}
+
+void Cc1101::SetRfProfile(RfProfile profile) {
+  const auto& table = kRfConfigTables[static_cast<size_t>(profile)];
+  if (shadow_valid_ && profile == profile_) return;
+
+  profile_ = profile;
+  EnterIdle();
+  WriteConfigurationRegisters(kFirstProfileRegister, table.data() + kFirstProfileRegister,
+                              kLastProfileRegister - kFirstProfileRegister + 1);
+  WriteConfigurationRegisters(CC_TEST2, table.data() + CC_TEST2, CC_TEST0 - CC_TEST2 + 1);
+  if (packet_length_ == PacketLength::kVariable) ApplyPacketLength();
+  // Calibration results depend on the synthesizer settings.
+  InvalidateCalibration();
+  LOG_INF("RF profile %d: %d bps", static_cast<int>(profile), GetRfProfileSettings(profile).modem.bitrate_bps);
+}
+
+void Cc1101::SetAddressFilter(uint8_t address, AddressCheck check) {
+  WriteConfigurationRegister(CC_ADDR, address);
+  WriteConfigurationRegister(CC_PKTCTRL1, (shadow_[CC_PKTCTRL1] & ~0b11) | static_cast<uint8_t>(check));
+}
+
+void Cc1101::SetPacketLength(PacketLength mode) {
+  packet_length_ = mode;
+  EnterIdle();
+  ApplyPacketLength();
+}
+
+void Cc1101::ApplyPacketLength() {
+  const bool variable = packet_length_ == PacketLength::kVariable;
+  const auto& table = kRfConfigTables[static_cast<size_t>(profile_)];
+  // PKTCTRL0.LENGTH_CONFIG: 00 - fixed, 01 - variable.
+  WriteConfigurationRegister(CC_PKTCTRL0, (shadow_[CC_PKTCTRL0] & ~0b11) | (variable ? 0b01 : 0b00));
+  ApplyCrcAutoflush();
+  // MDMCFG1.FEC_EN: FEC is only supported with fixed packet length.
+  WriteConfigurationRegister(CC_MDMCFG1, variable ? shadow_[CC_MDMCFG1] & ~kFecEnabled : table[CC_MDMCFG1]);
+}
+
+void Cc1101::ApplyCrcAutoflush() {
+  // PKTCTRL1.CRC_AUTOFLUSH flushes the whole RX FIFO on bad CRC, so it's only allowed with a single
+  // packet in the FIFO. Async RX (RXOFF_MODE = RX) queues several of them, including the good ones
+  // DrainRxFifo is about to read, and in variable length mode the flush would lose the track of
+  // packet boundaries. Packets with bad CRC are skipped by DrainRxFifo there.
+  const bool allowed = packet_length_ == PacketLength::kFixed && atomic_get(&async_mode_) == kAsyncOff;
+  const auto& table = kRfConfigTables[static_cast<size_t>(profile_)];
+  WriteConfigurationRegister(CC_PKTCTRL1, allowed ? shadow_[CC_PKTCTRL1] | (table[CC_PKTCTRL1] & kCrcAutoflush)
+                                                  : shadow_[CC_PKTCTRL1] & ~kCrcAutoflush);
+}
+
+void Cc1101::SetTxPacketSize(uint8_t size) {
+  // In variable length mode PKTLEN only limits the length of received packets.
+  if (packet_length_ == PacketLength::kFixed) SetPacketSize(size);
+}
+
+void Cc1101::Sleep() {
+  if (asleep_) return;
+  EnterIdle();
+  // CC1101 enters SLEEP once CSn goes high after the strobe.
+  WriteStrobe(CC_SPWD);
+  asleep_ = true;
+}
+
+void Cc1101::WakeUp() {
+  if (!asleep_) return;
+  // Must be cleared first, so below register writes don't try to wake radio up again.
+  asleep_ = false;
+  if (!WaitUntilReady()) LOG_ERR("CC1101 is not ready after SLEEP");
+
+  // All other configuration registers (including FSCAL ones, so cached calibration
+  // is still valid) are retained in SLEEP. FIFOs are flushed.
+  RestoreRegistersLostInSleep();
+  // GDO0 could have toggled while entering and leaving SLEEP.
+  k_sem_reset(&gd_ready_);
+}
+
+void Cc1101::RestoreRegistersLostInSleep() {
+  WriteConfigurationRegisters(CC_TEST2, &shadow_[CC_TEST2], CC_TEST0 - CC_TEST2 + 1);
+  WriteConfigurationRegisters(CC_PATABLE, &patable_shadow_, 1);
+}
+
+void Cc1101::InvalidateCalibration() {
+  for (auto& c : calibrations_) c.timestamp = 0;
 }
 
 void Cc1101::RfConfig() {
-  WriteConfigurationRegister(CC_FSCTRL1, CC_FSCTRL1_VALUE);   // Frequency synthesizer control.
-  WriteConfigurationRegister(CC_FSCTRL0, CC_FSCTRL0_VALUE);   // Frequency synthesizer control.
-  WriteConfigurationRegister(CC_FREQ2, CC_FREQ2_VALUE);       // Frequency control word, high byte.
-  WriteConfigurationRegister(CC_FREQ1, CC_FREQ1_VALUE);       // Frequency control word, middle byte.
-  WriteConfigurationRegister(CC_FREQ0, CC_FREQ0_VALUE);       // Frequency control word, low byte.
-  WriteConfigurationRegister(CC_MDMCFG4, CC_MDMCFG4_VALUE);   // Modem configuration.
-  WriteConfigurationRegister(CC_MDMCFG3, CC_MDMCFG3_VALUE);   // Modem configuration.
-  WriteConfigurationRegister(CC_MDMCFG2, CC_MDMCFG2_VALUE);   // Modem configuration.
-  WriteConfigurationRegister(CC_MDMCFG1, CC_MDMCFG1_VALUE);   // Modem configuration.
-  WriteConfigurationRegister(CC_MDMCFG0, CC_MDMCFG0_VALUE);   // Modem configuration.
-  WriteConfigurationRegister(CC_CHANNR, CC_CHANNR_VALUE);     // Channel number.
-  WriteConfigurationRegister(CC_DEVIATN, CC_DEVIATN_VALUE);   // Modem deviation setting (when FSK modulation is enabled).
-  WriteConfigurationRegister(CC_FREND1, CC_FREND1_VALUE);     // Front end RX configuration.
-  WriteConfigurationRegister(CC_FREND0, CC_FREND0_VALUE);     // Front end RX configuration.
-  WriteConfigurationRegister(CC_MCSM0, CC_MCSM0_VALUE);       // Main Radio Control State Machine configuration.
-  WriteConfigurationRegister(CC_FOCCFG, CC_FOCCFG_VALUE);     // Frequency Offset Compensation Configuration.
-  WriteConfigurationRegister(CC_BSCFG, CC_BSCFG_VALUE);       // Bit synchronization Configuration.
-  WriteConfigurationRegister(CC_AGCCTRL2, CC_AGCCTRL2_VALUE); // AGC control.
-  WriteConfigurationRegister(CC_AGCCTRL1, CC_AGCCTRL1_VALUE); // AGC control.
-  WriteConfigurationRegister(CC_AGCCTRL0, CC_AGCCTRL0_VALUE); // AGC control.
-  WriteConfigurationRegister(CC_FSCAL3, CC_FSCAL3_VALUE);     // Frequency synthesizer calibration.
-  WriteConfigurationRegister(CC_FSCAL2, CC_FSCAL2_VALUE);     // Frequency synthesizer calibration.
-  WriteConfigurationRegister(CC_FSCAL1, CC_FSCAL1_VALUE);     // Frequency synthesizer calibration.
-  WriteConfigurationRegister(CC_FSCAL0, CC_FSCAL0_VALUE);     // Frequency synthesizer calibration.
-  WriteConfigurationRegister(CC_TEST2, CC_TEST2_VALUE);       // Various test settings.
-  WriteConfigurationRegister(CC_TEST1, CC_TEST1_VALUE);       // Various test settings.
-  WriteConfigurationRegister(CC_TEST0, CC_TEST0_VALUE);       // Various test settings.
-  WriteConfigurationRegister(CC_FIFOTHR, CC_FIFOTHR_VALUE);   // fifo threshold
-  WriteConfigurationRegister(CC_IOCFG2, CC_IOCFG2_VALUE);     // GDO2 output pin configuration.
-  WriteConfigurationRegister(CC_IOCFG0, CC_IOCFG0_VALUE);     // GDO0 output pin configuration.
-  WriteConfigurationRegister(CC_PKTCTRL1, CC_PKTCTRL1_VALUE); // Packet automation control.
-  WriteConfigurationRegister(CC_PKTCTRL0, CC_PKTCTRL0_VALUE); // Packet automation control.
-
-  WriteConfigurationRegister(CC_PATABLE, CC_Pwr0dBm);
-
-  WriteConfigurationRegister(CC_MCSM2, CC_MCSM2_VALUE);
-  WriteConfigurationRegister(CC_MCSM1, CC_MCSM1_VALUE);
-}
\ No newline at end of file
+  // Registers 0x29-0x2B (FSTEST, PTEST, AGCTEST) are for test only and must not be written,
+  // so configuration is uploaded in two bursts around them.
+  const auto& table = kRfConfigTables[static_cast<size_t>(profile_)];
+  WriteConfigurationRegisters(CC_IOCFG2, table.data(), CC_RCCTRL0 + 1);
+  WriteConfigurationRegisters(CC_TEST2, table.data() + CC_TEST2, CC_TEST0 - CC_TEST2 + 1);
+  // Test registers keep their reset values which are also in the table.
+  for (uint8_t reg = CC_FSTEST; reg <= CC_AGCTEST; ++reg) shadow_[reg] = table[reg];
+}
@@ -7,7 +7,9 @@
 #include <zephyr/kernel.h>
 
 #include "cc1101_constants.h"
+#include "cc1101_rf_profiles.h"
 #include "cc1101_rf_settings.h"
+#include "pw_function/function.h"
 
 // Uses SPI_1 instance. So devicetree should contain something like
 // &spi1 {
@@ -17,46 +19,331 @@
 //   miso-pin = <7>;
 //   cs-gpios = <&gpio0 5 0>;
 // };
+// Optionally, cc1101-miso alias can point to a node with `gpios` property describing
+// the MISO pin. Then readiness of the chip is detected by sampling it instead of
+// sleeping for a fixed (and quite long) time.
 
 // Datasheet: http://www.ti.com/lit/ds/symlink/cc1101.pdf
 
+// Received packet together with the reception quality information CC1101 appends to it.
+template<typename RadioPacketT>
+struct ReceivedRadioPacket {
+  RadioPacketT packet;
+  // Received signal strength, dBm.
+  int8_t rssi_dbm;
+  // Link quality indicator, i.e. how easily the packet was demodulated. Lower is better.
+  uint8_t lqi;
+  bool crc_ok;
+};
+
 class Cc1101 {
+ public:
+  // Maximal size of the packet which can be received.
+  static constexpr size_t kMaxPacketSize = 32;
+  // How many received packets can be queued before AwaitPacket picks them up.
+  static constexpr size_t kAsyncQueueDepth = 8;
+  // How many packets can wait for transmission in QueueTransmit.
+  static constexpr size_t kTxQueueDepth = 4;
+  // Calibration results are cached for channels 0..kCalibratedChannels-1,
+  // other channels are calibrated before every transfer.
+  static constexpr uint8_t kCalibratedChannels = 8;
+  // Cached calibration is discarded after that time, as it drifts with temperature.
+  static constexpr int64_t kCalibrationMaxAgeMs = 60 * 1000;
+  // Longest Wake-on-Radio period supported by StartWakeOnRadio.
+  static constexpr uint32_t kMaxWorPeriodMs = 1820;
+
+  // Part of the Wake-on-Radio period during which radio is listening.
+  // See datasheet p.81, MCSM2.RX_TIME description (for WORCTRL.WOR_RES = 0).
+  enum class WorRxTime : uint8_t {
+    k12_5Percent = 0,
+    k6_25Percent = 1,
+    k3_13Percent = 2,
+    k1_56Percent = 3,
+    k0_78Percent = 4,
+    k0_39Percent = 5,
+    k0_20Percent = 6,
+  };
+
+  // Hardware address filtering, see SetAddressFilter. Values are PKTCTRL1.ADR_CHK.
+  enum class AddressCheck : uint8_t {
+    kNone = 0,
+    kExact = 1,
+    // Also accept packets sent to 0x00.
+    kExactOrBroadcast = 2,
+    // Also accept packets sent to 0x00 or 0xFF.
+    kExactOrBothBroadcasts = 3,
+  };
+
+  // See SetPacketLength.
+  enum class PacketLength : uint8_t {
+    kFixed,
+    kVariable,
+  };
+
+  // Received packet of not known in advance type, see AwaitRawPacket.
+  struct RawReceivedPacket {
+    uint8_t size;
+    uint8_t data[kMaxPacketSize];
+    int8_t rssi_dbm;
+    uint8_t lqi;
+    bool crc_ok;
+  };
+
  private:
+  // Frequency synthesizer calibration results for a single channel,
+  // see datasheet p.57, 28.2 "Frequency Hopping and Multi-Channel Systems".
+  struct ChannelCalibration {
+    uint8_t fscal3;
+    uint8_t fscal2;
+    uint8_t fscal1;
+    // Uptime of the calibration, 0 if there is none.
+    int64_t timestamp = 0;
+  };
+
+  struct ReceivedPacket {
+    uint8_t size;
+    uint8_t data[kMaxPacketSize];
+    // Appended status bytes, see datasheet p.37, Table 27.
+    uint8_t rssi;
+    uint8_t lqi_and_crc_ok;
+  };
+
+  struct OutgoingPacket {
+    uint8_t size;
+    uint8_t data[kMaxPacketSize];
+  };
+
   const static device* spi_;
   static spi_config spi_config_;
   static k_sem gd_ready_;
   static gpio_callback gdo0_callback_data_;
+  static Cc1101* instance_;
+  static char rx_queue_buffer_[kAsyncQueueDepth * sizeof(ReceivedPacket)];
+  static k_msgq rx_queue_;
+  static char tx_queue_buffer_[kTxQueueDepth * sizeof(OutgoingPacket)];
+  static k_msgq tx_queue_;
+
+  // In-RAM copy of configuration registers (CC_IOCFG2 to CC_TEST0) and PATABLE,
+  // used to skip writes which won't change anything. Only trusted when
+  // shadow_valid_ is set, i.e. after the full configuration was uploaded.
+  uint8_t shadow_[CC_TEST0 + 1] = {};
+  uint8_t patable_shadow_ = 0;
+  bool shadow_valid_ = false;
+  bool asleep_ = false;
+  // Radio was armed by ArmWakeOnRadio, so it has been sleeping between RX windows.
+  bool wor_armed_ = false;
+  bool auto_sleep_ = false;
+  uint32_t register_writes_ = 0;
+  uint32_t suppressed_register_writes_ = 0;
+
+  ChannelCalibration calibrations_[kCalibratedChannels];
+  RfProfile profile_ = RfProfile::kDefault;
+
+  // Values of async_mode_.
+  static constexpr atomic_val_t kAsyncOff = 0;
+  static constexpr atomic_val_t kAsyncRx = 1;
+  static constexpr atomic_val_t kAsyncWor = 2;
+  static constexpr atomic_val_t kAsyncTx = 3;
+
+  k_work rx_work_;
+  // Not kAsyncOff if radio is armed by StartReceive or StartWakeOnRadio, or is
+  // sending packets from tx_queue_. In that mode GDO0 interrupts are handled by
+  // rx_work_ or tx_work_ instead of waking up Transmit/Receive callers.
+  atomic_t async_mode_ = kAsyncOff;
+  uint8_t async_packet_size_ = 0;
+
+  // State of the transmit queue. Only touched from tx_work_.
+  k_work tx_work_;
+  // Set from GDO0 interrupt when the packet on air is sent.
+  atomic_t tx_done_ = 0;
+  // Size of the packet on air, 0 if none.
+  uint8_t tx_on_air_size_ = 0;
+  // Size of the next packet, which is already in the TX FIFO, 0 if none.
+  uint8_t tx_preloaded_size_ = 0;
+  pw::Function<void(bool sent)> on_transmitted_;
+
+  PacketLength packet_length_ = PacketLength::kFixed;
+  // Variable packet length mode: length of the packet which is being drained from
+  // the RX FIFO (its length byte was already read), 0 if none.
+  uint8_t rx_pending_length_ = 0;
 
  public:
   void Init();
   void SetChannel(uint8_t channel) { WriteConfigurationRegister(CC_CHANNR, channel); }
+  // One of CC_Pwr* values, Init sets CC_PwrMinus30dBm.
+  void SetTxPower(uint8_t APwr) { WriteConfigurationRegister(CC_PATABLE, APwr); }
 
   template <typename RadioPacketT>
   void Transmit(RadioPacketT& packet) {
-    SetPacketSize(sizeof(RadioPacketT));
+    SetTxPacketSize(sizeof(RadioPacketT));
     Recalibrate();
     EnterTX();
     WriteTX(packet);
     k_sem_take(&gd_ready_, K_FOREVER);
+    if (auto_sleep_) Sleep();
+  }
+
+  // Listen-before-talk version of Transmit: listens to the channel first and only sends the packet
+  // if it's clear, i.e. RSSI is below carrier sense threshold and no packet is being received
+  // (MCSM1.CCA_MODE = 11, PKTSTATUS.CCA). Returns false without sending anything otherwise.
+  template <typename RadioPacketT>
+  bool TransmitIfChannelClear(const RadioPacketT& packet) {
+    static_assert(sizeof(RadioPacketT) <= kMaxPacketSize, "Packet is too big");
+    return TransmitIfChannelClear(&packet, sizeof(RadioPacketT));
+  }
+
+  // Non-blocking version of TransmitIfChannelClear. Queues a copy of the packet and returns
+  // immediately, false if the queue is full or radio is busy receiving (see StartReceive).
+  // Queued packets are sent one by one from the system workqueue. Each one is loaded into the
+  // TX FIFO before radio starts listening (the next one while the previous is still on air, if
+  // both fit), so the clear channel check is just the STX strobe: with MCSM1.CCA_MODE = 11 radio
+  // only leaves RX if the channel is clear. After the packet, radio returns to IDLE by itself
+  // (MCSM1.TXOFF_MODE) and the transmit callback is called. Packets are not retried, that's up
+  // to the caller (see BeaconMac). Once the queue is drained, radio stays in IDLE, or goes to
+  // SLEEP with SetAutoSleep. Blocking Transmit/Receive must not be used while packets are queued.
+  template <typename RadioPacketT>
+  bool QueueTransmit(const RadioPacketT& packet) {
+    static_assert(sizeof(RadioPacketT) <= kMaxPacketSize, "Packet is too big");
+    return QueueTransmit(&packet, sizeof(RadioPacketT));
+  }
+
+  // Sets a function to be called (from the system workqueue) for every packet queued by
+  // QueueTransmit: with true once it's sent, with false if it was dropped as the channel was busy.
+  void SetTransmitCallback(pw::Function<void(bool sent)> on_transmitted) {
+    on_transmitted_ = std::move(on_transmitted);
   }
 
   template<typename RadioPacketT>
   bool Receive(uint32_t timeout_ms, RadioPacketT* result) {
-    LOG_MODULE_DECLARE();
+    static_assert(sizeof(RadioPacketT) <= kMaxPacketSize, "Packet is too big");
 
     SetPacketSize(sizeof(RadioPacketT));
     Recalibrate();
     FlushRxFIFO();
     EnterRX();
+    bool received = false;
     if (k_sem_take(&gd_ready_, K_MSEC(timeout_ms)) == 0) {
-      return ReadFifo(result);
+      received = ReadFifo(result);
     } else {
       EnterIdle();
+    }
+    if (auto_sleep_) Sleep();
+    return received;
+  }
+
+  // Switches between fixed (default) and variable packet length (PKTCTRL0.LENGTH_CONFIG).
+  // In variable length mode, every packet is preceded on air by a length byte (added and
+  // stripped by the driver), so packets of different sizes can share a channel and a receive
+  // session. Packet size passed to Receive/StartReceive/StartWakeOnRadio then becomes the
+  // maximal accepted one. CC1101 only supports FEC with fixed packet length, so it's
+  // disabled in variable length mode regardless of the RF profile. Reset by Init.
+  void SetPacketLength(PacketLength mode);
+  PacketLength GetPacketLength() const { return packet_length_; }
+
+  // Non-blocking alternative to Receive. Arms the radio and returns immediately.
+  // Radio stays in RX after receiving a packet (MCSM1.RXOFF_MODE = RX) until
+  // StopReceive is called. Packets are drained from the RX FIFO in the system
+  // workqueue as soon as they arrive and queued until fetched by AwaitPacket.
+  // Transmit/Receive must not be called while armed.
+  template<typename RadioPacketT>
+  void StartReceive() {
+    static_assert(sizeof(RadioPacketT) <= kMaxPacketSize, "Packet is too big");
+    StartReceive(sizeof(RadioPacketT));
+  }
+  void StartReceive(uint8_t packet_size);
+
+  // Like StartReceive, but radio duty-cycles RX on its own using Wake-on-Radio:
+  // it sleeps, wakes up every period_ms (up to kMaxWorPeriodMs) and listens for
+  // rx_time part of the period. MCU is only woken up (through GDO0) when a packet
+  // with correct CRC is received. Note that the first listening window happens at the
+  // end of the first period, not right away.
+  // Once a packet is received, radio switches to the continuous RX (as in StartReceive),
+  // so packets sent by other transmitters at around the same time are not lost.
+  // See datasheet p.52, 19.5 "Wake On Radio (WOR)".
+  template<typename RadioPacketT>
+  void StartWakeOnRadio(uint32_t period_ms, WorRxTime rx_time) {
+    static_assert(sizeof(RadioPacketT) <= kMaxPacketSize, "Packet is too big");
+    StartWakeOnRadio(sizeof(RadioPacketT), period_ms, rx_time);
+  }
+  void StartWakeOnRadio(uint8_t packet_size, uint32_t period_ms, WorRxTime rx_time);
+
+  // Disarms the radio armed by StartReceive or StartWakeOnRadio and leaves it in IDLE.
+  // Packets already queued are kept and still can be fetched by AwaitPacket.
+  void StopReceive();
+
+  // Waits up to timeout_ms for the packet received after StartReceive or StartWakeOnRadio.
+  // timeout_ms = 0 means just polling the queue.
+  // Returns false if there was no packet (or it had unexpected size).
+  template<typename RadioPacketT>
+  bool AwaitPacket(uint32_t timeout_ms, ReceivedRadioPacket<RadioPacketT>* result) {
+    LOG_MODULE_DECLARE();
+    RawReceivedPacket packet;
+    if (!AwaitRawPacket(timeout_ms, &packet)) return false;
+    if (packet.size != sizeof(RadioPacketT)) {
+      LOG_WRN("Dropping queued packet of unexpected size %d", packet.size);
       return false;
     }
+    memcpy(&result->packet, packet.data, sizeof(RadioPacketT));
+    result->rssi_dbm = packet.rssi_dbm;
+    result->lqi = packet.lqi;
+    result->crc_ok = packet.crc_ok;
+    return true;
+  }
+
+  // Same as above, but for callers which interpret the packet bytes themselves.
+  bool AwaitRawPacket(uint32_t timeout_ms, RawReceivedPacket* result);
+
+  // Same as above, but without reception quality information.
+  template<typename RadioPacketT>
+  bool AwaitPacket(uint32_t timeout_ms, RadioPacketT* result) {
+    ReceivedRadioPacket<RadioPacketT> received;
+    if (!AwaitPacket(timeout_ms, &received)) return false;
+    *result = received.packet;
+    return true;
   }
 
-  void EnterPwrDown() { WriteStrobe(CC_SPWD); }
+  // Converts raw RSSI value (from the RSSI status register or the appended status byte) to dBm.
+  // See datasheet p.44, 17.3 "RSSI".
+  static constexpr int8_t RssiToDbm(uint8_t raw) {
+    // RSSI offset for 868 MHz, same for all data rates we use (Table 31).
+    constexpr int16_t kRssiOffsetDb = 74;
+    return static_cast<int16_t>(static_cast<int8_t>(raw)) / 2 - kRssiOffsetDb;
+  }
+
+  // Switches modem configuration (data rate, FEC, preamble length) to one of the precomputed
+  // profiles from cc1101_rf_profiles.h. Only the profile-dependent registers are uploaded, in a burst.
+  // Must not be called while receiving or transmitting asynchronously. Chosen profile is kept by Init.
+  void SetRfProfile(RfProfile profile);
+  RfProfile GetRfProfile() const { return profile_; }
+
+  // Makes radio drop received packets which first byte (address) doesn't match the given one,
+  // with broadcast addresses accepted depending on check. Filtering happens before the packet
+  // reaches RX FIFO, so other installations sharing the channel don't wake the MCU up.
+  // Transmitted packets must start with the address byte then. Reset by Init.
+  void SetAddressFilter(uint8_t address, AddressCheck check);
+
+  // Forgets all cached calibration results, so every channel will be recalibrated
+  // before the next use. Call it on significant supply voltage or temperature change.
+  void InvalidateCalibration();
+
+  // Puts radio into SLEEP, its lowest power state. Any later operation wakes it up first (see WakeUp),
+  // so callers don't need to track the state. Must not be called while receiving or transmitting
+  // asynchronously.
+  void Sleep();
+  // Wakes radio up from SLEEP: waits until its crystal oscillator is running (MISO goes low) and
+  // restores registers which are lost in SLEEP (PATABLE and TEST2..TEST0) from the shadow.
+  void WakeUp();
+  bool IsAsleep() const { return asleep_; }
+  // If enabled, radio goes to SLEEP instead of staying in IDLE after blocking Transmit,
+  // TransmitIfChannelClear and Receive, and once the transmit queue is drained.
+  // Wake up takes ~0.3 ms (40 ms on boards without cc1101-miso alias), so that pays off
+  // if radio is idle for more than a few milliseconds.
+  void SetAutoSleep(bool enabled) { auto_sleep_ = enabled; }
+
+  // Statistics of configuration register writes since Init.
+  // Suppressed writes are ones which were skipped as register already had requested value.
+  uint32_t GetRegisterWrites() const { return register_writes_; }
+  uint32_t GetSuppressedRegisterWrites() const { return suppressed_register_writes_; }
 
  private:
   // Sends a single-byte instruction to the CC1101.
@@ -69,85 +356,106 @@ class Cc1101 {
   // See detailed description of available registers in datasheet, p.66
   // 29 Configuration Registers and Table 45: SPI Address Space.
   // If statuses is provided (must be a 2-byte array), status bytes will be written into it.
+  // Otherwise, write is skipped if register is known to already have this value.
   void WriteConfigurationRegister(uint8_t reg, uint8_t value, uint8_t* statuses = nullptr);
 
+  // Sets count consecutive configuration registers starting from first_reg in a single burst transfer.
+  // See datasheet p.31, 10.3 Register Access.
+  void WriteConfigurationRegisters(uint8_t first_reg, const uint8_t* values, size_t count);
+
+  // Waits for CC1101 crystal oscillator to stabilize, i.e. for MISO to go low
+  // after CSn is pulled low. Required after reset and when leaving SLEEP or XOFF states,
+  // see datasheet p.29, "4-wire Serial Configuration and Data Interface".
+  // Returns false on timeout.
+  bool WaitUntilReady();
+
   // Reads a configuration or status register.
   // If status is provided, status byte will be written into it.
   uint8_t ReadRegister(uint8_t reg, uint8_t* status = nullptr);
 
   template <typename RadioPacketT>
   void WriteTX(RadioPacketT& packet) {
-    uint8_t tx_flags = CC_FIFO | CC_WRITE_FLAG | CC_BURST_FLAG;
-
-    spi_buf tx_bufs[2];
+    WriteFifoBytes(reinterpret_cast<const uint8_t*>(&packet), sizeof(RadioPacketT));
+  }
 
-    tx_bufs[0].buf = &tx_flags;
-    tx_bufs[0].len = 1;
+  // Sets PKTLEN for transmitting a packet of a given size (only matters in fixed length mode).
+  void SetTxPacketSize(uint8_t size);
+  // Writes PKTCTRL0, PKTCTRL1 and MDMCFG1 bits which depend on packet_length_.
+  void ApplyPacketLength();
+  // Sets PKTCTRL1.CRC_AUTOFLUSH if it's safe with the current packet_length_ and async_mode_.
+  void ApplyCrcAutoflush();
 
-    tx_bufs[1].buf = static_cast<void*>(&packet);
-    tx_bufs[1].len = sizeof(RadioPacketT);
+  // Runs a burst (FIFO or multi-register) transfer. With CONFIG_SPI_ASYNC, it's done by the SPI
+  // peripheral in the background (EasyDMA on nRF) and the calling thread sleeps in k_poll until it
+  // completes. Single register accesses are too short for that to pay off and stay synchronous.
+  static int TransferBurst(const spi_buf_set* tx_bufs, const spi_buf_set* rx_bufs);
 
-    spi_buf_set tx_bufs_set = {
-        .buffers = tx_bufs,
-        .count = 2};
-
-    auto r = spi_write(spi_, &spi_config_, &tx_bufs_set);
-    if (r != 0) {
-      LOG_MODULE_DECLARE();
-      LOG_ERR("WriteTX fail: %d", r);
-    }
-  }
+  // Writes a packet of count bytes to the TX FIFO in a single burst transfer.
+  // In variable length mode, it's preceded with the length byte.
+  void WriteFifoBytes(const uint8_t* data, size_t count);
 
   template<typename RadioPacketT>
   bool ReadFifo(RadioPacketT* result) {
-    LOG_MODULE_DECLARE();
-    uint8_t status = 0;
-    uint8_t b = ReadRegister(CC_PKTSTATUS, &status);
-    if (!(b & 0x80)) {
-      LOG_WRN("Weird, no data, packet status = %d, read register status =%d", b, status);
-      return false;
-    } else {
-      LOG_DBG("CRC OK, packet status = %d, read register status =%d", b, status);
-    }
-    uint8_t tx = CC_FIFO | CC_READ_FLAG | CC_BURST_FLAG;
-    uint8_t rx[sizeof(RadioPacketT) + 3];
-
-    spi_buf tx_buf = {
-        .buf = &tx,
-        .len = 1};
+    return ReadFifo(result, sizeof(RadioPacketT));
+  }
 
-    spi_buf_set tx_bufs = {
-        .buffers = &tx_buf,
-        .count = 1};
+  // Reads a single packet of a given size from the RX FIFO.
+  // Returns false if there is no packet with the correct CRC.
+  bool ReadFifo(void* result, size_t size);
 
-    spi_buf rx_buf = {
-        .buf = rx,
-        .len = sizeof(RadioPacketT) + 3};
+  // Reads count raw bytes from the RX FIFO in a single burst transfer.
+  void ReadFifoBytes(uint8_t* result, size_t count);
 
-    spi_buf_set rx_bufs = {
-        .buffers = &rx_buf,
-        .count = 1};
+  // Reads a status register which can change while being read (e.g. RXBYTES),
+  // repeating until two consecutive reads agree. See CC1101 Errata Notes,
+  // "SPI Read Synchronization Issue".
+  uint8_t ReadVolatileStatusRegister(uint8_t reg);
 
-    auto r = spi_transceive(spi_, &spi_config_, &tx_bufs, &rx_bufs);
-    if (r != 0) {
-      LOG_MODULE_DECLARE();
-      LOG_ERR("ReadFifo fail: %d", r);
-    }
+  void ArmAsyncRx();
+  // Configures GDO0 to assert (and interrupt on the rising edge) once a packet with good CRC is received.
+  void EnableCrcOkInterrupt();
+  void ArmWakeOnRadio(uint32_t period_ms, WorRxTime rx_time);
+  // Switches radio armed by ArmWakeOnRadio to continuous RX.
+  void SwitchWorToRx();
+  // Rewrites registers lost in SLEEP (PATABLE and TEST2..TEST0) from the shadow.
+  void RestoreRegistersLostInSleep();
+  // Called in IDLE after WOR, which sleeps between RX windows just like Sleep.
+  void LeaveWakeOnRadio();
+  // Moves all complete packets from the RX FIFO to rx_queue_.
+  void DrainRxFifo();
 
-    memcpy(result, rx + 1, sizeof(RadioPacketT));
-    return true;
-  }
+  bool TransmitIfChannelClear(const void* packet, size_t size);
+  // Waits until radio is in RX and RSSI is valid, so PKTSTATUS.CCA and STX rely on the current channel.
+  void SettleCarrierSense();
+  bool QueueTransmit(const void* packet, size_t size);
+  // Advances the transmit queue: handles the end of the packet on air, then starts the next one.
+  void PumpTxQueue();
+  // Moves the next queued packet to the TX FIFO. Returns false if there is none,
+  // or it can't be loaded while the current one is on air.
+  bool PreloadNextTx();
+  // Listens to the channel and strobes STX to send the preloaded packet.
+  // Returns false if the channel was busy, the packet is flushed then.
+  bool StartPreloadedTx();
 
   static void Gdo0Callback(const device *dev, gpio_callback *cb, gpio_port_pins_t pins);
+  static void RxWorkHandler(k_work* work);
+  static void TxWorkHandler(k_work* work);
 
   void RfConfig();
 
+  // Called by all SPI helpers: any SPI access wakes CC1101 up, but it's only usable once ready.
+  void EnsureAwake() {
+    if (asleep_) WakeUp();
+  }
   void Reset() { WriteStrobe(CC_SRES); }
   void EnterTX() { WriteStrobe(CC_STX); }
   void EnterRX() { WriteStrobe(CC_SRX); }
   void EnterIdle() { WriteStrobe(CC_SIDLE); }
+  void EnterWor() { WriteStrobe(CC_SWOR); }
   void FlushRxFIFO() { WriteStrobe(CC_SFRX); }
-  void SetTxPower(uint8_t APwr) { WriteConfigurationRegister(CC_PATABLE, APwr); }
+  void FlushTxFIFO() { WriteStrobe(CC_SFTX); }
+  // Enters IDLE and makes sure frequency synthesizer is calibrated for the current channel,
+  // either by restoring cached calibration results or by running the calibration.
   void Recalibrate();
 
  public:
@@ -0,0 +1,83 @@
+#pragma once
+
+#include <array>
+#include <cstddef>
+#include <cstdint>
+
+// Runtime-selectable modem configurations for CC1101, see Cc1101::SetRfProfile.
+// All this is for 27.0 MHz crystal, and for 868 MHz carrier (same as cc1101_rf_settings.h).
+
+// Bitrate-specific register values, RF studio.
+struct Cc1101ModemSettings {
+  uint32_t bitrate_bps;
+  uint8_t fsctrl1;   // Frequency synthesizer control: IF
+  uint8_t mdmcfg4;   // }
+  uint8_t mdmcfg3;   // } Modem configuration: channel bandwidth and data rate
+  uint8_t mdmcfg2;   // Filter, modulation format, Manchester coding, SYNC_MODE
+  uint8_t deviatn;   // Modem deviation setting
+  uint8_t frend1;    // Front end RX configuration
+  uint8_t foccfg;    // Frequency Offset Compensation
+  uint8_t bscfg;     // Bit synchronization Configuration
+  uint8_t agcctrl2;  // }
+  uint8_t agcctrl1;  // }
+  uint8_t agcctrl0;  // } AGC control
+  uint8_t fscal3;    // Frequency synthesizer calibration
+  uint8_t test2;     // }
+  uint8_t test1;     // }
+  uint8_t test0;     // } Various test settings
+};
+
+namespace cc1101_modem {
+// All of them use SYNC_MODE=011 => 30/32 sync word bits.
+constexpr Cc1101ModemSettings k10k = {
+    10000, 0x06, 0xC8, 0x84, 0x13, 0x34, 0x56, 0x16, 0x6C, 0x43, 0x40, 0x91, 0xE9, 0x81, 0x35, 0x09};
+constexpr Cc1101ModemSettings k38k4 = {
+    38400, 0x06, 0xCA, 0x75, 0x13, 0x34, 0x56, 0x16, 0x6C, 0x03, 0x40, 0x91, 0xE9, 0x81, 0x31, 0x09};
+// GFSK, 46 kHz deviation.
+constexpr Cc1101ModemSettings k100k = {
+    100000, 0x08, 0x5B, 0xE5, 0x13, 0x46, 0xB6, 0x1D, 0x1C, 0xC7, 0x00, 0xB2, 0xEA, 0x81, 0x35, 0x09};
+constexpr Cc1101ModemSettings k250k = {
+    250000, 0x0C, 0x2D, 0x2F, 0x13, 0x62, 0xB6, 0x1D, 0x1C, 0xC7, 0x00, 0xB0, 0xEA, 0x88, 0x31, 0x09};
+// MSK.
+constexpr Cc1101ModemSettings k500k = {
+    500000, 0x0E, 0x0E, 0x2F, 0x73, 0x00, 0xB6, 0x1D, 0x1C, 0xC7, 0x00, 0xB0, 0xEA, 0x88, 0x31, 0x09};
+}  // namespace cc1101_modem
+
+struct Cc1101RfProfileSettings {
+  Cc1101ModemSettings modem;
+  // Forward error correction with interleaving. Doubles the air time, but gives a few dB of sensitivity.
+  bool fec;
+  // One of 2, 3, 4, 6, 8, 12, 16, 24.
+  uint8_t preamble_bytes;
+  // Time for RSSI (and so carrier sense) to become valid after entering RX. Grows with the symbol time.
+  uint32_t carrier_sense_settle_us;
+};
+
+// Values are stable, they are stored in EEPROM and exposed via Bluetooth.
+enum class RfProfile : uint8_t {
+  kLongRange = 0,
+  kDefault = 1,
+  kShortAirtime = 2,
+};
+constexpr size_t kRfProfileCount = 3;
+
+// Indexed by RfProfile.
+constexpr std::array<Cc1101RfProfileSettings, kRfProfileCount> kRfProfiles = {{
+    {.modem = cc1101_modem::k10k, .fec = true, .preamble_bytes = 4, .carrier_sense_settle_us = 2000},
+    {.modem = cc1101_modem::k250k, .fec = true, .preamble_bytes = 4, .carrier_sense_settle_us = 300},
+    {.modem = cc1101_modem::k500k, .fec = false, .preamble_bytes = 4, .carrier_sense_settle_us = 200},
+}};
+
+constexpr const Cc1101RfProfileSettings& GetRfProfileSettings(RfProfile profile) {
+  return kRfProfiles[static_cast<size_t>(profile)];
+}
+
+// Value of MDMCFG1.NUM_PREAMBLE for the given preamble length, kInvalidNumPreamble if it's not supported.
+constexpr uint8_t kInvalidNumPreamble = 0xFF;
+constexpr uint8_t NumPreambleField(uint8_t preamble_bytes) {
+  constexpr uint8_t kLengths[] = {2, 3, 4, 6, 8, 12, 16, 24};
+  for (uint8_t i = 0; i < std::size(kLengths); ++i) {
+    if (kLengths[i] == preamble_bytes) return i << 4;
+  }
+  return kInvalidNumPreamble;
+}
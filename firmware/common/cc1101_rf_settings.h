@@ -9,13 +9,6 @@
 
 // All this is for 27.0 MHz crystal, and for 868 MHz carrier
 
-// Bitrate
-//#define CC_BITRATE_10K
-//#define CC_BITRATE_38K4
-//#define  CC_BITRATE_100K
-#define CC_BITRATE_250K
-//#define CC_BITRATE_500K
-
 // ============================ Common use values ==============================
 #define CC_TX_FIFO_SIZE     33
 #define CC_RX_FIFO_SIZE     32
@@ -40,10 +33,7 @@
 
 // =================================== Common ==================================
 // ==== MDMCFG1 ==== 7 FEC_EN, 6:4 NUM_PREAMBLE, 3:2 not used, 1:0 CHANSPC_E
-#define CC_FEC_EN           0x80    // Fec enabled
-//#define CC_FEC_EN           0x00    // Fec disabled
-#define CC_NUM_PREAMBLE     0x20    // 010 => 4 bytes of preamble
-#define CC_MDMCFG1_VALUE    (CC_FEC_EN | CC_NUM_PREAMBLE | CC_CHANSPC_E)
+// FEC and preamble length are RF profile parameters, see cc1101_rf_profiles.h.
 
 //#define CC_MCSM0_VALUE      0x18        // Calibrate at IDLE->RX,TX
 #define CC_MCSM0_VALUE      0x08        // Never calibrate
@@ -72,148 +62,13 @@
 #define CC_ADDR_VALUE       0x01        // Device address.
 
 // ========================= Bitrate-specific ==================================
-#ifdef CC_BITRATE_10K
-#define CC_FSCTRL1_VALUE    0x06        // Frequency synthesizer control: IF - RF studio
+// Moved to RF profiles, see cc1101_rf_profiles.h. These are the same for all the bitrates:
 #define CC_FSCTRL0_VALUE    0x00        // Frequency synthesizer control: freq offset
-
-#define CC_MDMCFG4_VALUE    0xC8        // Modem configuration: channel bandwidth
-#define CC_MDMCFG3_VALUE    0x84        // Modem configuration.
-#define CC_MDMCFG2_VALUE    0x13        // Filter, modulation format, Manchester coding, SYNC_MODE=011 => 30/32 sync word bits
-
-#define CC_DEVIATN_VALUE    0x34        // Modem deviation setting - RF studio
-#define CC_FREND1_VALUE     0x56        // Front end RX configuration - RF studio
-#define CC_FREND0_VALUE     0x10        // Front end TX configuration.
-
-#define CC_FOCCFG_VALUE     0x16        // Frequency Offset Compensation Configuration - RF studio
-#define CC_BSCFG_VALUE      0x6C        // Bit synchronization Configuration - RF studio
-//#define CC_AGCCTRL2_VALUE   0x03        // AGC control: All gain settings can be used, max gain, 33 dB magn target
-#define CC_AGCCTRL2_VALUE   0x43        // AGC control: RF studio
-#define CC_AGCCTRL1_VALUE   0x40        // AGC control: RF studio
-#define CC_AGCCTRL0_VALUE   0x91        // AGC control: RF studio
-
-#define CC_FSCAL3_VALUE     0xE9        // }
-#define CC_FSCAL2_VALUE     0x2A        // }
-#define CC_FSCAL1_VALUE     0x00        // }
-#define CC_FSCAL0_VALUE     0x1F        // } Frequency synthesizer calibration: RF studio
-
-#define CC_TEST2_VALUE      0x81        // Various test settings: RF studio
-#define CC_TEST1_VALUE      0x35        // Various test settings: RF studio
-#define CC_TEST0_VALUE      0x09        // Various test settings: RF studio
-
-// ********************
-#elif defined CC_BITRATE_38K4
-#define CC_FSCTRL1_VALUE    0x06        // }
-#define CC_FSCTRL0_VALUE    0x00        // } Frequency synthesizer control: RF studio, nothing to do here
-
-#define CC_MDMCFG4_VALUE    0xCA        // }
-#define CC_MDMCFG3_VALUE    0x75        // } Modem configuration: RF Studio, nothing to do here
-#define CC_MDMCFG2_VALUE    0x13        // Filter, modulation format, Manchester coding, SYNC_MODE=011 => 30/32 sync word bits
-
-#define CC_DEVIATN_VALUE    0x34        // Modem deviation setting - RF studio, nothing to do here
-#define CC_FREND1_VALUE     0x56        // Front end RX configuration - RF studio, no docs, nothing to do
 #define CC_FREND0_VALUE     0x10        // Front end TX configuration - RF studio, no docs, nothing to do
-
-#define CC_FOCCFG_VALUE     0x16        // Frequency Offset Compensation - RF studio, some unknown reasons for settings
-#define CC_BSCFG_VALUE      0x6C        // Bit synchronization Configuration - RF studio, some unknown reasons for settings
-#define CC_AGCCTRL2_VALUE   0x03        // AGC control: 00 - all gain settings, 000 - max possible gain, 011 - target ampl=33dB
-#define CC_AGCCTRL1_VALUE   0x40        // Generally, nothing interesting
-#define CC_AGCCTRL0_VALUE   0x91        // AGC filter settings: RF studio, some unknown reasons for settings
-
-#define CC_FSCAL3_VALUE     0xE9        // }
-#define CC_FSCAL2_VALUE     0x2A        // }
-#define CC_FSCAL1_VALUE     0x00        // }
-#define CC_FSCAL0_VALUE     0x1F        // } Frequency synthesizer calibration: RF studio, nothing to do here
-
-#define CC_TEST2_VALUE      0x81        // Various test settings: RF studio
-#define CC_TEST1_VALUE      0x31        // Various test settings: RF studio
-#define CC_TEST0_VALUE      0x09        // Various test settings: RF studio
-
-// ********************
-#elif defined CC_BITRATE_100K
-#define CC_FSCTRL1_VALUE    0x08        // }
-#define CC_FSCTRL0_VALUE    0x00        // } Frequency synthesizer control: RF studio, nothing to do here
-
-#define CC_MDMCFG4_VALUE    0x5B        // }
-#define CC_MDMCFG3_VALUE    0xE5        // } Modem configuration: RF Studio, nothing to do here
-//#define CC_MDMCFG2_VALUE    0x11        // Filter, GFSK, no Manchester coding, SYNC_MODE=010 => 16/16 sync word bits
-#define CC_MDMCFG2_VALUE    0x13        // Filter, GFSK, no Manchester coding, SYNC_MODE=011 => 30/32 sync word bits
-
-#define CC_DEVIATN_VALUE    0x46        // Modem deviation setting: 46 kHz
-#define CC_FREND1_VALUE     0xB6        // Front end RX configuration - RF studio, no docs, nothing to do
-#define CC_FREND0_VALUE     0x10        // Front end TX configuration - RF studio, no docs, nothing to do
-
-#define CC_FOCCFG_VALUE     0x1D        // Frequency Offset Compensation - RF studio, some unknown reasons for settings
-#define CC_BSCFG_VALUE      0x1C        // Bit synchronization Configuration - RF studio, some unknown reasons for settings
-#define CC_AGCCTRL2_VALUE   0xC7        // AGC control: 00 - all gain settings, 000 - max possible gain, 111 - target ampl=42dB
-#define CC_AGCCTRL1_VALUE   0x00        // Generally, nothing interesting
-#define CC_AGCCTRL0_VALUE   0xB2        // AGC filter settings: RF studio, some unknown reasons for settings
-
-#define CC_FSCAL3_VALUE     0xEA        // }
 #define CC_FSCAL2_VALUE     0x2A        // }
 #define CC_FSCAL1_VALUE     0x00        // }
 #define CC_FSCAL0_VALUE     0x1F        // } Frequency synthesizer calibration: RF studio, nothing to do here
 
-#define CC_TEST2_VALUE      0x81        // Various test settings: RF studio
-#define CC_TEST1_VALUE      0x35        // Various test settings: RF studio
-#define CC_TEST0_VALUE      0x09        // Various test settings: RF studio
-
-// ********************
-#elif defined CC_BITRATE_250K
-#define CC_FSCTRL1_VALUE    0x0C        // }
-#define CC_FSCTRL0_VALUE    0x00        // } Frequency synthesizer control: RF studio, nothing to do here
-
-#define CC_MDMCFG4_VALUE    0x2D        // }
-#define CC_MDMCFG3_VALUE    0x2F        // } Modem configuration: RF Studio, nothing to do here
-#define CC_MDMCFG2_VALUE    0x13        // Filter, modulation format, no Manchester coding, SYNC_MODE=011 => 30/32 sync word bits
-//#define CC_MDMCFG2_VALUE    0x11        // Filter, modulation format, no Manchester coding, SYNC_MODE=001 => 15/16 sync word bits
-
-#define CC_DEVIATN_VALUE    0x62        // Modem deviation setting - RF studio, nothing to do here
-#define CC_FREND1_VALUE     0xB6        // Front end RX configuration - RF studio, no docs, nothing to do
-#define CC_FREND0_VALUE     0x10        // Front end TX configuration - RF studio, no docs, nothing to do
-
-#define CC_FOCCFG_VALUE     0x1D        // Frequency Offset Compensation - RF studio, some unknown reasons for settings
-#define CC_BSCFG_VALUE      0x1C        // Bit synchronization Configuration - RF studio, some unknown reasons for settings
-#define CC_AGCCTRL2_VALUE   0xC7        // AGC control: 00 - all gain settings, 000 - max possible gain, 111 - target ampl=42dB
-#define CC_AGCCTRL1_VALUE   0x00        // Generally, nothing interesting
-#define CC_AGCCTRL0_VALUE   0xB0        // AGC filter settings: RF studio, some unknown reasons for settings
-
-#define CC_FSCAL3_VALUE     0xEA        // }
-#define CC_FSCAL2_VALUE     0x2A        // }
-#define CC_FSCAL1_VALUE     0x00        // }
-#define CC_FSCAL0_VALUE     0x1F        // } Frequency synthesizer calibration: RF studio, nothing to do here
-
-#define CC_TEST2_VALUE      0x88        // Various test settings: RF studio
-#define CC_TEST1_VALUE      0x31        // Various test settings: RF studio
-#define CC_TEST0_VALUE      0x09        // Various test settings: RF studio
-
-#elif defined CC_BITRATE_500K // ================== 500k =======================
-#define CC_FSCTRL1_VALUE    0x0E        // }
-#define CC_FSCTRL0_VALUE    0x00        // } Frequency synthesizer control: RF studio, nothing to do here
-
-#define CC_MDMCFG4_VALUE    0x0E        // }
-#define CC_MDMCFG3_VALUE    0x2F        // } Modem configuration: RF Studio, nothing to do here
-#define CC_MDMCFG2_VALUE    0x73        // Filter on, modulation format MSK, no Manchester, SYNC_MODE=011 => 30/32 sync word bits
-
-#define CC_DEVIATN_VALUE    0x00        // Modem deviation setting - RF studio, nothing to do here
-#define CC_FREND1_VALUE     0xB6        // Front end RX configuration - RF studio, no docs, nothing to do
-#define CC_FREND0_VALUE     0x10        // Front end TX configuration - RF studio, no docs, nothing to do
-
-#define CC_FOCCFG_VALUE     0x1D        // Frequency Offset Compensation - RF studio, some unknown reasons for settings
-#define CC_BSCFG_VALUE      0x1C        // Bit synchronization Configuration - RF studio, some unknown reasons for settings
-#define CC_AGCCTRL2_VALUE   0xC7        // AGC control: 00 - all gain settings, 000 - max possible gain, 111 - target ampl=42dB
-#define CC_AGCCTRL1_VALUE   0x00        // Generally, nothing interesting
-#define CC_AGCCTRL0_VALUE   0xB0        // AGC filter settings: RF studio, some unknown reasons for settings
-
-#define CC_FSCAL3_VALUE     0xEA        // }
-#define CC_FSCAL2_VALUE     0x2A        // }
-#define CC_FSCAL1_VALUE     0x00        // }
-#define CC_FSCAL0_VALUE     0x1F        // } Frequency synthesizer calibration: RF studio, nothing to do here
-
-#define CC_TEST2_VALUE      0x88        // Various test settings: RF studio
-#define CC_TEST1_VALUE      0x31        // Various test settings: RF studio
-#define CC_TEST0_VALUE      0x09        // Various test settings: RF studio
-#endif
-
 // Rare use settings
 #define CC_SYNC1_VALUE      0xD3
 #define CC_SYNC0_VALUE      0x91
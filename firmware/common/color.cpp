@@ -1,6 +1,7 @@
 #include "color.h"
 
 #include <algorithm>
+#include <array>
 #include <cstdlib>
 
 namespace {
@@ -25,9 +26,54 @@ inline void moveByStep(uint8_t& move_what, uint8_t move_where, uint8_t step) {
   }
 }
 
+inline uint16_t InterpolateComponent(uint16_t from, uint16_t to, uint32_t step, uint32_t steps) {
+  return from + (int32_t(to) - from) * int64_t(step) / steps;
+}
+
 inline uint32_t CalculateDelay(int16_t difference, uint32_t total_time) {
     return total_time / (abs(difference) + 4) + 1;
 }
+
+// round(65536 * 2^(-i/16)), last one is for the linear interpolation.
+constexpr std::array<uint32_t, 17> kExp2NegTable = {
+    65536, 62757, 60097, 57549, 55109, 52773, 50535, 48393, 46341,
+    44376, 42495, 40693, 38968, 37316, 35734, 34219, 32768};
+
+// 2^(-x), x is Q8.8 and is in [0, 1).
+inline uint32_t Exp2NegFractionQ16(uint32_t x_q8) {
+  const uint32_t i = x_q8 >> 4;
+  const uint32_t t = x_q8 & 0xF;
+  return (kExp2NegTable[i] * (16 - t) + kExp2NegTable[i + 1] * t) / 16;
+}
+
+inline uint32_t PackColor(const Color& c) {
+  return c.r | (c.g << 8) | (c.b << 16);
+}
+
+inline Color UnpackColor(uint32_t packed) {
+  return Color(packed & 0xFF, (packed >> 8) & 0xFF, (packed >> 16) & 0xFF);
+}
+
+inline uint8_t ScaleComponent(uint8_t c, WeightQ8 weight) {
+  return std::min<uint32_t>(255, (c * weight) >> 8);
+}
+
+#if defined(__ARM_FEATURE_DSP) && __ARM_FEATURE_DSP
+inline uint32_t Max8(uint32_t a, uint32_t b) {
+  uint32_t result;
+  // SEL picks bytes of a where USUB8 set the GE flags (a >= b), they must stay in one asm block.
+  __asm("usub8 %0, %1, %2\n\tsel %0, %1, %2" : "=&r"(result) : "r"(a), "r"(b) : "cc");
+  return result;
+}
+#else
+inline uint32_t Max8(uint32_t a, uint32_t b) {
+  uint32_t result = 0;
+  for (int shift = 0; shift < 32; shift += 8) {
+    result |= std::max((a >> shift) & 0xFF, (b >> shift) & 0xFF) << shift;
+  }
+  return result;
+}
+#endif
 }
 
 void Color::Adjust(const Color& other) {
@@ -49,4 +95,84 @@ uint32_t Color::DelayToTheNextAdjustment(const Color& other, uint32_t total_adju
     CalculateDelay(g - other.g, total_adjustment_time),
     CalculateDelay(b - other.b, total_adjustment_time)
   });
-}
\ No newline at end of file
+}
+
+LinearColor Interpolate(const LinearColor& from, const LinearColor& to, uint32_t step, uint32_t steps) {
+  if (step >= steps) return to;
+  return {InterpolateComponent(from.r, to.r, step, steps), InterpolateComponent(from.g, to.g, step, steps),
+          InterpolateComponent(from.b, to.b, step, steps)};
+}
+
+Color Interpolate(const Color& from, const Color& to, uint32_t step, uint32_t steps) {
+  if (step >= steps) return to;
+  return FromLinear(Interpolate(ToLinear(from), ToLinear(to), step, steps));
+}
+
+uint32_t DecayFactorQ16(uint32_t age_ms, uint32_t half_life_ms) {
+  if (half_life_ms == 0) return 1 << 16;
+  const uint32_t halvings = age_ms / half_life_ms;
+  if (halvings >= 16) return 0;
+  const uint32_t fraction_q8 = uint64_t(age_ms % half_life_ms) * 256 / half_life_ms;
+  return Exp2NegFractionQ16(fraction_q8) >> halvings;
+}
+
+uint32_t GrowthFactorQ16(uint32_t age_ms, uint32_t half_life_ms) {
+  if (half_life_ms == 0) return 1 << 16;
+  const uint32_t doublings = age_ms / half_life_ms;
+  const uint32_t fraction_q8 = uint64_t(age_ms % half_life_ms) * 256 / half_life_ms;
+  // 2^(f) = 2 * 2^(-(1 - f)), and 2^(-0) is handled separately to stay in the table range.
+  const uint32_t fraction = fraction_q8 == 0 ? 1 << 16 : 2 * Exp2NegFractionQ16(256 - fraction_q8);
+  return fraction << doublings;
+}
+
+ColorContribution DecayingColorMixer::Add(const Color& color, WeightQ8 weight, int64_t now) {
+  const uint64_t growth = GrowthFactorQ16(now - reference_time_, half_life_ms_);
+  const ColorContribution c = {
+      .r = uint32_t((color.r * weight * growth) >> 16),
+      .g = uint32_t((color.g * weight * growth) >> 16),
+      .b = uint32_t((color.b * weight * growth) >> 16),
+      .weight = uint32_t((weight * growth) >> 16),
+  };
+  AddToSums(c);
+  return c;
+}
+
+void DecayingColorMixer::Remove(const ColorContribution& c) {
+  r_ -= c.r;
+  g_ -= c.g;
+  b_ -= c.b;
+  weight_ -= c.weight;
+}
+
+Color DecayingColorMixer::Get(int64_t now) const {
+  // Sums of color * weight (Q8.8) and of weights, as of now.
+  const uint64_t decay = DecayFactorQ16(now - reference_time_, half_life_ms_);
+  const uint32_t r = (r_ * decay) >> 16;
+  const uint32_t g = (g_ * decay) >> 16;
+  const uint32_t b = (b_ * decay) >> 16;
+  const uint32_t divisor =
+      mode_ == ColorMixMode::kAverage ? std::max<uint32_t>((weight_ * decay) >> 16, kWeightOne) : kWeightOne;
+  return Color(std::min<uint32_t>(255, r / divisor), std::min<uint32_t>(255, g / divisor),
+               std::min<uint32_t>(255, b / divisor));
+}
+
+void DecayingColorMixer::Reset(int64_t now) {
+  r_ = g_ = b_ = weight_ = 0;
+  reference_time_ = now;
+}
+
+void DecayingColorMixer::AddToSums(const ColorContribution& c) {
+  r_ += c.r;
+  g_ += c.g;
+  b_ += c.b;
+  weight_ += c.weight;
+}
+
+void MaxColorMixer::Add(const Color& color, WeightQ8 weight) {
+  packed_ = Max8(packed_, PackColor({ScaleComponent(color.r, weight), ScaleComponent(color.g, weight),
+                                     ScaleComponent(color.b, weight)}));
+}
+
+Color MaxColorMixer::Get() const {
+  return UnpackColor(packed_);
+}
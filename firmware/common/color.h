@@ -1,11 +1,13 @@
 #pragma once
 
+#include <algorithm>
+#include <array>
 #include <cstdint>
 
 struct Color {
   uint8_t r = 0, g = 0, b = 0;
-  Color() {}
-  Color(uint8_t r_, uint8_t g_, uint8_t b_) : r(r_), g(g_), b(b_) {}
+  constexpr Color() {}
+  constexpr Color(uint8_t r_, uint8_t g_, uint8_t b_) : r(r_), g(g_), b(b_) {}
   bool operator==(const Color& other) const { return r == other.r && g == other.g && b == other.b; };
 
   bool operator==(const Color& other) { return r == other.r && g == other.g && b == other.b; } ;
@@ -22,4 +24,146 @@ struct Color {
   uint32_t DelayToTheNextAdjustment(const Color& other, uint32_t total_adjustment_time) const;
 } __attribute__((packed));
 
+// Light intensity, Q0.16 per component (65535 is full brightness). Unlike Color components, which are
+// perceptual (CIE 1931 lightness), these are proportional to the amount of light, i.e. to the PWM duty cycle.
+struct LinearColor {
+  uint16_t r = 0, g = 0, b = 0;
+  bool operator==(const LinearColor& other) const = default;
+};
 
+constexpr std::array<uint16_t, 256> MakeLightnessToLinearTable() {
+  std::array<uint16_t, 256> table = {};
+  for (int i = 0; i < 256; ++i) {
+    // CIE 1931: L* = 116 * Y^(1/3) - 16, with a linear segment near black.
+    const double l = 100.0 * i / 255;
+    const double t = (l + 16) / 116;
+    const double y = l <= 8 ? l / 903.3 : t * t * t;
+    table[i] = uint16_t(y * 65535 + 0.5);
+  }
+  return table;
+}
+
+// Computed at compile time, so the conversion is a table lookup.
+inline constexpr std::array<uint16_t, 256> kLightnessToLinear = MakeLightnessToLinearTable();
+static_assert(kLightnessToLinear[0] == 0 && kLightnessToLinear[255] == 65535);
+
+constexpr uint16_t ToLinear(uint8_t component) {
+  return kLightnessToLinear[component];
+}
+
+constexpr LinearColor ToLinear(const Color& color) {
+  return {ToLinear(color.r), ToLinear(color.g), ToLinear(color.b)};
+}
+
+// Inverse of ToLinear, rounds to the closest component.
+constexpr uint8_t FromLinear(uint16_t component) {
+  const auto it = std::lower_bound(kLightnessToLinear.begin(), kLightnessToLinear.end(), component);
+  if (it == kLightnessToLinear.begin()) return 0;
+  const bool round_down = component - *(it - 1) < *it - component;
+  return (it - kLightnessToLinear.begin()) - (round_down ? 1 : 0);
+}
+
+inline Color FromLinear(const LinearColor& color) {
+  return Color(FromLinear(color.r), FromLinear(color.g), FromLinear(color.b));
+}
+
+// Color at step out of steps of the transition from `from` (step 0) to `to` (step == steps).
+// Interpolation is linear in light intensity, so the perceived change is fast near black and slow near
+// full brightness, as it is for the physical light.
+LinearColor Interpolate(const LinearColor& from, const LinearColor& to, uint32_t step, uint32_t steps);
+Color Interpolate(const Color& from, const Color& to, uint32_t step, uint32_t steps);
+
+// Fixed-point weight, Q8.8 (kWeightOne is 1.0).
+using WeightQ8 = uint16_t;
+constexpr WeightQ8 kWeightOne = 0x100;
+
+// 2^(-age_ms / half_life_ms) in Q0.16 (65536 is 1.0), i.e. how much of a contribution is left
+// after age_ms. No decay if half_life_ms is 0.
+uint32_t DecayFactorQ16(uint32_t age_ms, uint32_t half_life_ms);
+// 2^(age_ms / half_life_ms) in Q16.16, inverse of DecayFactorQ16. age_ms must be below 15 half lives.
+uint32_t GrowthFactorQ16(uint32_t age_ms, uint32_t half_life_ms);
+
+enum class ColorMixMode : uint8_t {
+  // Sum of weighted colors, saturating at 255. Many sources quickly mix to white.
+  kAdditive,
+  // Weighted average, but not brighter than kAdditive: sum of weighted colors divided by
+  // the sum of weights if it's above 1.0. Single weak source stays dim, many strong ones don't saturate.
+  kAverage,
+  // Per-component maximum of weighted colors.
+  kMax,
+};
+
+// Contribution of one source to DecayingColorMixer, stored by the caller (e.g. PacketsLog entry)
+// to remove it later.
+struct ColorContribution {
+  // color * weight (Q8.8) and weight, scaled by the growth since the reference time of the mixer.
+  uint32_t r = 0, g = 0, b = 0, weight = 0;
+};
+
+// Mixes colors of a changing set of sources, each with its own weight, which decays exponentially
+// since the source was added (ColorMixMode::kAdditive and kAverage). Per-component sums of the
+// contributions are updated by Add and Remove, so Get costs the same for any number of sources.
+// - Decay is common for all sources, so contributions are stored scaled up by the growth since the
+//   reference time and the sums are scaled down by the decay since then in Get.
+// - Growth of new contributions must stay below 2^kRebaseHalfLives, so once NeedsRebase says so,
+//   the caller moves the reference time forward with Rebase, passing all the stored contributions.
+// - kMax can't be kept as a running value (sources can't be removed from it), use MaxColorMixer
+//   over the sources instead.
+class DecayingColorMixer {
+ public:
+  static constexpr uint32_t kRebaseHalfLives = 8;
+
+  // half_life_ms = 0 disables decay.
+  DecayingColorMixer(ColorMixMode mode, uint32_t half_life_ms) : mode_(mode), half_life_ms_(half_life_ms) {}
+
+  // Adds the source and returns its contribution. now must not be before the reference time.
+  ColorContribution Add(const Color& color, WeightQ8 weight, int64_t now);
+  void Remove(const ColorContribution& contribution);
+  // Black if there are no sources.
+  Color Get(int64_t now) const;
+
+  // Moves reference time to now without rescaling, only for the mixer without sources.
+  void Reset(int64_t now);
+  bool NeedsRebase(int64_t now) const {
+    return half_life_ms_ != 0 && now - reference_time_ >= int64_t(kRebaseHalfLives) * half_life_ms_;
+  }
+  // Moves reference time to now. for_each(f) must call f(ColorContribution&) for every stored contribution,
+  // they are rescaled in place.
+  template <typename ForEachContribution>
+  void Rebase(int64_t now, ForEachContribution&& for_each) {
+    const uint64_t decay = DecayFactorQ16(now - reference_time_, half_life_ms_);
+    r_ = g_ = b_ = weight_ = 0;
+    for_each([this, decay](ColorContribution& c) {
+      c.r = (c.r * decay) >> 16;
+      c.g = (c.g * decay) >> 16;
+      c.b = (c.b * decay) >> 16;
+      c.weight = (c.weight * decay) >> 16;
+      AddToSums(c);
+    });
+    reference_time_ = now;
+  }
+
+  uint32_t half_life_ms() const { return half_life_ms_; }
+
+ private:
+  void AddToSums(const ColorContribution& c);
+
+  const ColorMixMode mode_;
+  const uint32_t half_life_ms_;
+  int64_t reference_time_ = 0;
+  uint64_t r_ = 0, g_ = 0, b_ = 0, weight_ = 0;
+};
+
+// Per-component maximum of weighted colors (ColorMixMode::kMax), the mode DecayingColorMixer can't
+// keep running sums for. Components are kept packed in one word, so on Cortex-M4 each source costs
+// USUB8 + SEL.
+class MaxColorMixer {
+ public:
+  void Add(const Color& color, WeightQ8 weight);
+  // Black if nothing was added.
+  Color Get() const;
+
+ private:
+  // 0x00BBGGRR.
+  uint32_t packed_ = 0;
+};
@@ -0,0 +1,102 @@
+#include "frame_scheduler.h"
+
+#include <algorithm>
+
+FrameScheduler::Effect::Effect(pw::Function<void()> render, uint32_t slack_ms)
+    : render_(std::move(render)), slack_ms_(slack_ms) {
+  GetInstance().Register(*this);
+}
+
+FrameScheduler::Effect::~Effect() {
+  GetInstance().Unregister(*this);
+}
+
+void FrameScheduler::Effect::RunDelayed(uint32_t delay_ms) {
+  GetInstance().Schedule(*this, delay_ms);
+}
+
+void FrameScheduler::Effect::Cancel() {
+  GetInstance().Cancel(*this);
+}
+
+FrameScheduler& FrameScheduler::GetInstance() {
+  static FrameScheduler instance;
+  return instance;
+}
+
+FrameScheduler::FrameScheduler() {
+  k_timer_init(&timer_, TimerHandler, nullptr);
+}
+
+void FrameScheduler::TimerHandler(k_timer* timer) {
+  GetInstance().RenderDue();
+}
+
+void FrameScheduler::Register(Effect& effect) {
+  const k_spinlock_key_t key = k_spin_lock(&lock_);
+  effect.next_ = effects_;
+  effects_ = &effect;
+  k_spin_unlock(&lock_, key);
+}
+
+void FrameScheduler::Unregister(Effect& effect) {
+  const k_spinlock_key_t key = k_spin_lock(&lock_);
+  for (Effect** e = &effects_; *e != nullptr; e = &(*e)->next_) {
+    if (*e == &effect) {
+      *e = effect.next_;
+      break;
+    }
+  }
+  RearmLocked(k_uptime_get());
+  k_spin_unlock(&lock_, key);
+}
+
+void FrameScheduler::Schedule(Effect& effect, uint32_t delay_ms) {
+  const k_spinlock_key_t key = k_spin_lock(&lock_);
+  const int64_t now = k_uptime_get();
+  const int64_t deadline = now + delay_ms;
+  const int64_t aligned = (deadline + kTickMs - 1) / kTickMs * kTickMs;
+  effect.due_ms_ = std::min<int64_t>(aligned, deadline + effect.slack_ms_);
+  RearmLocked(now);
+  k_spin_unlock(&lock_, key);
+}
+
+void FrameScheduler::Cancel(Effect& effect) {
+  const k_spinlock_key_t key = k_spin_lock(&lock_);
+  effect.due_ms_ = Effect::kNotScheduled;
+  RearmLocked(k_uptime_get());
+  k_spin_unlock(&lock_, key);
+}
+
+void FrameScheduler::RenderDue() {
+  ++wakeups_;
+  k_spinlock_key_t key = k_spin_lock(&lock_);
+  const int64_t now = k_uptime_get();
+  for (Effect* e = effects_; e != nullptr; e = e->next_) {
+    if (e->due_ms_ > now) continue;
+    e->due_ms_ = Effect::kNotScheduled;
+    e->rendering_ = true;
+  }
+  k_spin_unlock(&lock_, key);
+
+  // Without the lock, as effects reschedule themselves.
+  for (Effect* e = effects_; e != nullptr; e = e->next_) {
+    if (!e->rendering_) continue;
+    e->rendering_ = false;
+    e->render_();
+  }
+
+  key = k_spin_lock(&lock_);
+  RearmLocked(k_uptime_get());
+  k_spin_unlock(&lock_, key);
+}
+
+void FrameScheduler::RearmLocked(int64_t now) {
+  int64_t earliest = Effect::kNotScheduled;
+  for (const Effect* e = effects_; e != nullptr; e = e->next_) earliest = std::min(earliest, e->due_ms_);
+  if (earliest == Effect::kNotScheduled) {
+    k_timer_stop(&timer_);
+    return;
+  }
+  k_timer_start(&timer_, K_MSEC(std::max<int64_t>(0, earliest - now)), K_NO_WAIT);
+}
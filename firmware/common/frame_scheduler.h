@@ -0,0 +1,66 @@
+#pragma once
+
+#include <zephyr/kernel.h>
+
+#include <cstdint>
+
+#include "pw_function/function.h"
+
+// Drives all output effects (LED fades and animations, buzzer) from a single k_timer, so that
+// their wakeups coincide instead of landing at unrelated times.
+// - Effect due times are rounded up to multiples of kTickMs of uptime, within the effect's slack,
+//   so effects scheduled for nearby moments render in the same wakeup.
+// - The timer is only armed for the earliest due effect, and stopped when nothing is scheduled,
+//   so the scheduler doesn't tick at all while nothing is animating.
+// Render callbacks run in the timer (ISR) context, like Timer actions, and may reschedule their effect.
+class FrameScheduler {
+ public:
+  static constexpr uint32_t kTickMs = 10;
+  // Enough to always land on the tick grid.
+  static constexpr uint32_t kDefaultSlackMs = kTickMs;
+
+  class Effect {
+   public:
+    // Effect is rendered no earlier than requested and at most slack_ms later.
+    explicit Effect(pw::Function<void()> render, uint32_t slack_ms = kDefaultSlackMs);
+    Effect(const Effect&) = delete;
+    ~Effect();
+
+    // Replaces the previously scheduled render, if any.
+    void RunDelayed(uint32_t delay_ms);
+    void Cancel();
+
+   private:
+    friend class FrameScheduler;
+    static constexpr int64_t kNotScheduled = INT64_MAX;
+
+    pw::Function<void()> render_;
+    const uint32_t slack_ms_;
+    // Uptime to render at, guarded by FrameScheduler::lock_.
+    int64_t due_ms_ = kNotScheduled;
+    bool rendering_ = false;
+    Effect* next_ = nullptr;
+  };
+
+  static FrameScheduler& GetInstance();
+
+  // Number of timer wakeups so far, for measuring the coalescing.
+  uint32_t GetWakeups() const { return wakeups_; }
+
+ private:
+  FrameScheduler();
+
+  static void TimerHandler(k_timer* timer);
+  void Register(Effect& effect);
+  void Unregister(Effect& effect);
+  void Schedule(Effect& effect, uint32_t delay_ms);
+  void Cancel(Effect& effect);
+  void RenderDue();
+  // Arms the timer for the earliest due effect, must be called with lock_ held.
+  void RearmLocked(int64_t now);
+
+  k_timer timer_;
+  k_spinlock lock_;
+  Effect* effects_ = nullptr;
+  uint32_t wakeups_ = 0;
+};
@@ -0,0 +1,174 @@
+#pragma once
+
+#include <array>
+#include <cstddef>
+#include <cstdint>
+#include <span>
+
+#include "color.h"
+
+// Compact bytecode for RGB LED animations, played by RgbLedSequencer.
+// Each instruction is an opcode byte followed by its operands, 16-bit ones are little endian:
+//   kEnd                       Stops the animation.
+//   kSet r g b                 Sets the color immediately.
+//   kRamp r g b duration_ms16  Fades to the color, continues when the fade is over.
+//   kWait duration_ms16        Keeps the current color for a while.
+//   kLoop count                Repeats the instructions up to the matching kEndLoop count times (0 is forever).
+//   kEndLoop
+//   kJump offset16             Continues from the instruction at the byte offset.
+//   kWaitEvent mask            Waits until any of the events (bits) is signalled.
+// Built-in animations are assembled at compile time (see Assemble), uploaded ones are checked by Validate
+// before playing, so the player doesn't need any checks.
+namespace led_animation {
+
+enum class Op : uint8_t {
+  kEnd = 0,
+  kSet = 1,
+  kRamp = 2,
+  kWait = 3,
+  kLoop = 4,
+  kEndLoop = 5,
+  kJump = 6,
+  kWaitEvent = 7,
+};
+
+// Longer animations (and the 16-bit jump offsets) would be fine for the player, but there is
+// no place to store them.
+constexpr size_t kMaxSize = 256;
+constexpr size_t kMaxLoopDepth = 4;
+
+// Size of the instruction with operands, 0 for unknown opcodes.
+constexpr size_t InstructionSize(uint8_t op) {
+  switch (static_cast<Op>(op)) {
+    case Op::kEnd:
+    case Op::kEndLoop:
+      return 1;
+    case Op::kLoop:
+    case Op::kWaitEvent:
+      return 2;
+    case Op::kWait:
+    case Op::kJump:
+      return 3;
+    case Op::kSet:
+      return 4;
+    case Op::kRamp:
+      return 6;
+  }
+  return 0;
+}
+
+constexpr uint16_t ReadU16(const uint8_t* p) {
+  return p[0] | (p[1] << 8);
+}
+
+// Checks that the animation can be played safely: all instructions are complete and known, loops are
+// balanced and not nested deeper than kMaxLoopDepth, jumps land on instructions outside of loops,
+// and the last instruction is kEnd or kJump, so the player never runs past the end.
+constexpr bool Validate(std::span<const uint8_t> code) {
+  if (code.empty() || code.size() > kMaxSize) return false;
+  // Loop depth at every instruction start, kNotInstruction elsewhere.
+  constexpr uint8_t kNotInstruction = 0xFF;
+  std::array<uint8_t, kMaxSize> depth_at = {};
+  for (auto& d : depth_at) d = kNotInstruction;
+
+  size_t depth = 0;
+  size_t last = 0;
+  for (size_t pc = 0; pc < code.size(); pc += InstructionSize(code[pc])) {
+    const size_t size = InstructionSize(code[pc]);
+    if (size == 0 || pc + size > code.size()) return false;
+    depth_at[pc] = depth;
+    last = pc;
+    if (code[pc] == uint8_t(Op::kLoop) && ++depth > kMaxLoopDepth) return false;
+    if (code[pc] == uint8_t(Op::kEndLoop) && depth-- == 0) return false;
+  }
+  if (depth != 0) return false;
+  if (code[last] != uint8_t(Op::kEnd) && code[last] != uint8_t(Op::kJump)) return false;
+
+  for (size_t pc = 0; pc < code.size(); pc += InstructionSize(code[pc])) {
+    if (code[pc] != uint8_t(Op::kJump)) continue;
+    const uint16_t target = ReadU16(&code[pc + 1]);
+    if (depth_at[pc] != 0 || target >= code.size() || depth_at[target] != 0) return false;
+  }
+  return true;
+}
+
+// Assembler input, see the functions below.
+struct Instruction {
+  Op op;
+  Color color;
+  // Duration, loop count, events mask or jump target (index of the instruction, not the byte offset).
+  uint16_t value = 0;
+};
+
+constexpr Instruction End() { return {Op::kEnd}; }
+constexpr Instruction Set(const Color& color) { return {Op::kSet, color}; }
+constexpr Instruction Ramp(const Color& color, uint16_t duration_ms) { return {Op::kRamp, color, duration_ms}; }
+constexpr Instruction Wait(uint16_t duration_ms) { return {Op::kWait, {}, duration_ms}; }
+constexpr Instruction Loop(uint8_t count) { return {Op::kLoop, {}, count}; }
+constexpr Instruction EndLoop() { return {Op::kEndLoop}; }
+constexpr Instruction Jump(uint16_t instruction_index) { return {Op::kJump, {}, instruction_index}; }
+constexpr Instruction WaitEvent(uint8_t mask) { return {Op::kWaitEvent, {}, mask}; }
+
+template <size_t N>
+constexpr size_t EncodedSize(const Instruction (&code)[N]) {
+  size_t size = 0;
+  for (const auto& instruction : code) size += InstructionSize(uint8_t(instruction.op));
+  return size;
+}
+
+// Not constexpr, so calling it from Assemble stops the compilation.
+void InvalidLedAnimation();
+
+// Encodes and validates the animation at compile time:
+//   constexpr led_animation::Instruction kBlinkCode[] = {Loop(3), Set(white), Wait(100), ..., EndLoop(), End()};
+//   constexpr auto kBlink = led_animation::Assemble<kBlinkCode>();
+template <const auto& kCode>
+consteval auto Assemble() {
+  std::array<uint8_t, EncodedSize(kCode)> result = {};
+  // Byte offsets of the instructions, for jumps.
+  std::array<uint16_t, std::size(kCode)> offsets = {};
+  size_t pc = 0;
+  for (size_t i = 0; i < std::size(kCode); ++i) {
+    offsets[i] = pc;
+    pc += InstructionSize(uint8_t(kCode[i].op));
+  }
+
+  pc = 0;
+  for (const auto& instruction : kCode) {
+    uint8_t* p = &result[pc];
+    p[0] = uint8_t(instruction.op);
+    uint16_t value = instruction.value;
+    switch (instruction.op) {
+      case Op::kSet:
+      case Op::kRamp:
+        p[1] = instruction.color.r;
+        p[2] = instruction.color.g;
+        p[3] = instruction.color.b;
+        if (instruction.op == Op::kRamp) {
+          p[4] = value & 0xFF;
+          p[5] = value >> 8;
+        }
+        break;
+      case Op::kJump:
+        if (value >= std::size(kCode)) InvalidLedAnimation();
+        value = offsets[value];
+        [[fallthrough]];
+      case Op::kWait:
+        p[1] = value & 0xFF;
+        p[2] = value >> 8;
+        break;
+      case Op::kLoop:
+      case Op::kWaitEvent:
+        p[1] = value;
+        break;
+      case Op::kEnd:
+      case Op::kEndLoop:
+        break;
+    }
+    pc += InstructionSize(p[0]);
+  }
+  if (!Validate(result)) InvalidLedAnimation();
+  return result;
+}
+
+}  // namespace led_animation
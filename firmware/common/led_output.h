@@ -0,0 +1,23 @@
+#pragma once
+
+#include <cstdint>
+
+#include "color.h"
+
+// Something showing a single color: the PWM driven RgbLed, a whole LedStrip or one pixel of it.
+// RgbLedSequencer and the applications only talk to this interface, so they don't care which
+// one the board has. Methods can be called from the timer (ISR) context.
+class LedOutput {
+ public:
+  virtual ~LedOutput() = default;
+
+  virtual void SetColor(const Color& color) = 0;
+  // Fades to the color in linear light.
+  virtual void SetColorSmooth(const Color& color, uint32_t delay_ms) = 0;
+  // Current color, in the middle of a smooth transition too.
+  virtual Color GetColor() const = 0;
+
+  // For outputs with a switchable LED supply, nothing to do otherwise.
+  virtual void EnablePowerStabilizer() {}
+  virtual void DisablePowerStabilizer() {}
+};
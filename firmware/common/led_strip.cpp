@@ -0,0 +1,155 @@
+#include "led_strip.h"
+
+#include <zephyr/logging/log.h>
+
+#include <algorithm>
+
+LOG_MODULE_DECLARE();
+
+namespace {
+// SPI bit patterns of data bits 0 and 1.
+constexpr uint16_t kZero = 0b1000;
+constexpr uint16_t kOne = 0b1110;
+
+// SPI bit stream (16 bits) of every 4 data bits.
+constexpr std::array<uint16_t, 16> MakeNibbleTable() {
+  std::array<uint16_t, 16> table = {};
+  for (int nibble = 0; nibble < 16; ++nibble) {
+    for (int bit = 3; bit >= 0; --bit) table[nibble] = (table[nibble] << 4) | ((nibble >> bit) & 1 ? kOne : kZero);
+  }
+  return table;
+}
+constexpr std::array<uint16_t, 16> kNibbleToSpi = MakeNibbleTable();
+static_assert(kNibbleToSpi[0b1010] == 0xE8E8);
+
+// Linear light level the strip PWMs the LED with.
+uint8_t ToStripLevel(uint16_t linear) {
+  return std::min<uint32_t>(255, (linear + 128) >> 8);
+}
+}  // namespace
+
+uint8_t* LedStripBase::EncodeByte(uint8_t value, uint8_t* out) {
+  const uint16_t high = kNibbleToSpi[value >> 4];
+  const uint16_t low = kNibbleToSpi[value & 0x0F];
+  out[0] = high >> 8;
+  out[1] = high;
+  out[2] = low >> 8;
+  out[3] = low;
+  return out + 4;
+}
+
+LedStripBase::LedStripBase(const device* spi, std::span<PixelState> pixels, std::span<uint8_t> frame)
+    : spi_(spi),
+      spi_config_({
+          .frequency = kSpiFrequencyHz,
+          .operation = SPI_OP_MODE_MASTER | SPI_TRANSFER_MSB | SPI_WORD_SET(8) | SPI_LINES_SINGLE,
+          .slave = 0,
+          .cs = {},
+      }),
+      tx_buf_({.buf = frame.data(), .len = frame.size()}),
+      tx_bufs_({.buffers = &tx_buf_, .count = 1}),
+      pixels_(pixels),
+      frame_(frame),
+      render_work_({.strip = this}),
+      effect_([this]() { k_work_submit(&render_work_.work); }, /*slack_ms=*/0) {
+  k_work_init(&render_work_.work, RenderWorkHandler);
+  if (!device_is_ready(spi_)) LOG_ERR("LED strip SPI is not ready");
+}
+
+LinearColor LedStripBase::CurrentColor(const PixelState& pixel, uint32_t now) {
+  return Interpolate(pixel.from, ToLinear(pixel.target), now - pixel.fade_start_ms, pixel.fade_duration_ms);
+}
+
+void LedStripBase::UpdatePixel(PixelState& pixel, const Color& color, uint32_t delay_ms, uint32_t now) {
+  pixel.from = CurrentColor(pixel, now);
+  pixel.target = color;
+  pixel.fade_start_ms = now;
+  pixel.fade_duration_ms = delay_ms;
+}
+
+void LedStripBase::SetPixelColor(size_t index, const Color& color, uint32_t delay_ms) {
+  const uint32_t now = k_uptime_get_32();
+  const k_spinlock_key_t key = k_spin_lock(&lock_);
+  UpdatePixel(pixels_[index], color, delay_ms, now);
+  k_spin_unlock(&lock_, key);
+  RequestFrame(0);
+}
+
+Color LedStripBase::GetPixelColor(size_t index) const {
+  const uint32_t now = k_uptime_get_32();
+  const k_spinlock_key_t key = k_spin_lock(&lock_);
+  const PixelState pixel = pixels_[index];
+  k_spin_unlock(&lock_, key);
+  if (now - pixel.fade_start_ms >= pixel.fade_duration_ms) return pixel.target;
+  return FromLinear(CurrentColor(pixel, now));
+}
+
+void LedStripBase::SetColor(const Color& color) {
+  SetColorSmooth(color, 0);
+}
+
+void LedStripBase::SetColorSmooth(const Color& color, uint32_t delay_ms) {
+  const uint32_t now = k_uptime_get_32();
+  // Pixel by pixel, so interrupts are not blocked for the whole strip.
+  for (auto& pixel : pixels_) {
+    const k_spinlock_key_t key = k_spin_lock(&lock_);
+    UpdatePixel(pixel, color, delay_ms, now);
+    k_spin_unlock(&lock_, key);
+  }
+  RequestFrame(0);
+}
+
+Color LedStripBase::GetColor() const {
+  return GetPixelColor(0);
+}
+
+void LedStripBase::RequestFrame(uint32_t delay_ms) {
+  if (!atomic_set(&frame_pending_, 1)) effect_.RunDelayed(delay_ms);
+}
+
+void LedStripBase::RenderWorkHandler(k_work* work) {
+  CONTAINER_OF(work, RenderWork, work)->strip->Render();
+}
+
+void LedStripBase::Render() {
+  if (atomic_get(&transferring_)) {
+    // Previous frame is still being sent, frame_pending_ stays set.
+    effect_.RunDelayed(kFramePeriodMs);
+    return;
+  }
+  atomic_clear(&frame_pending_);
+
+  const uint32_t now = k_uptime_get_32();
+  bool fading = false;
+  uint8_t* out = frame_.data();
+  for (const auto& p : pixels_) {
+    const k_spinlock_key_t key = k_spin_lock(&lock_);
+    const PixelState pixel = p;
+    k_spin_unlock(&lock_, key);
+    fading |= now - pixel.fade_start_ms < pixel.fade_duration_ms;
+    const LinearColor color = CurrentColor(pixel, now);
+    out = EncodeByte(ToStripLevel(color.g), out);
+    out = EncodeByte(ToStripLevel(color.r), out);
+    out = EncodeByte(ToStripLevel(color.b), out);
+  }
+  if (fading) RequestFrame(kFramePeriodMs);
+  // Constructor has complained already.
+  if (!device_is_ready(spi_)) return;
+
+#if defined(CONFIG_SPI_ASYNC)
+  atomic_set(&transferring_, 1);
+  const int r = spi_transceive_cb(spi_, &spi_config_, &tx_bufs_, nullptr, OnTransferDone, this);
+  if (r != 0) {
+    LOG_ERR("LED strip transfer failed: %d", r);
+    atomic_clear(&transferring_);
+  }
+#else
+  // Still DMA, but the work queue waits for it.
+  const int r = spi_write(spi_, &spi_config_, &tx_bufs_);
+  if (r != 0) LOG_ERR("LED strip transfer failed: %d", r);
+#endif
+}
+
+void LedStripBase::OnTransferDone(const device* dev, int result, void* data) {
+  atomic_clear(&static_cast<LedStripBase*>(data)->transferring_);
+}
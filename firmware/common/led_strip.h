@@ -0,0 +1,133 @@
+#pragma once
+
+#include <array>
+#include <cstddef>
+#include <cstdint>
+#include <span>
+
+#include <zephyr/device.h>
+#include <zephyr/drivers/spi.h>
+#include <zephyr/kernel.h>
+
+#include "color.h"
+#include "frame_scheduler.h"
+#include "led_output.h"
+
+// WS2812 / SK6812 (RGB) addressable LED strip, with the data line on MOSI of an SPI master.
+// The SPI must be an EasyDMA one on nRF52, i.e. devicetree should contain something like
+// &spi2 {
+//   compatible = "nordic,nrf-spim";
+//   status = "okay";
+//   pinctrl-0 = <&spi2_default>;  // Only SPIM_MOSI is needed.
+//   pinctrl-names = "default";
+// };
+// and a led-strip-spi alias pointing to it.
+// - Each data bit is sent as 4 SPI bits at 4 MHz: 1000 for 0 and 1110 for 1, i.e. 250 or 750 ns
+//   pulses in 1 us bits. So a pixel (24 bits, GRB) takes 12 bytes of the frame buffer, which is
+//   preallocated for the whole strip and ends with the zeros of the latch pause.
+// - Bytes are encoded with a nibble lookup table in the system work queue, a 120 pixels frame takes
+//   well under a millisecond. Sending it (1.5 ms) is done by the DMA in the background
+//   (with CONFIG_SPI_ASYNC, otherwise the work queue waits for it).
+//   On nRF52832 DMA transfers are limited to 255 bytes, the driver chains them with a few
+//   microseconds pauses, which the LEDs tolerate (they latch after 80 us).
+// - Every pixel fades on its own in linear light, same as RgbLed. While anything fades, frames are
+//   rendered every kFramePeriodMs by the FrameScheduler, static strips don't wake the CPU at all.
+// - LEDs of the strip are PWM driven by the strip itself, so pixel bytes are linear light levels.
+class LedStripBase : public LedOutput {
+ public:
+  // ~60 frames per second.
+  static constexpr uint32_t kFramePeriodMs = 16;
+  static constexpr uint32_t kSpiFrequencyHz = 4'000'000;
+  static constexpr size_t kBytesPerPixel = 3 * 4;
+  // 100 us of low level, SK6812 latches the data after 80 us.
+  static constexpr size_t kLatchBytes = 50;
+
+  struct PixelState {
+    LinearColor from;
+    Color target = {0, 0, 0};
+    // Truncated uptime, differences are fine across the wraparound.
+    uint32_t fade_start_ms = 0;
+    uint32_t fade_duration_ms = 0;
+  };
+
+  // Writes the SPI bit stream of a data byte, 4 bytes, returns the end of it.
+  static uint8_t* EncodeByte(uint8_t value, uint8_t* out);
+
+  size_t size() const { return pixels_.size(); }
+
+  void SetPixelColor(size_t index, const Color& color, uint32_t delay_ms = 0);
+  Color GetPixelColor(size_t index) const;
+
+  // LedOutput, for the whole strip. GetColor is the color of the first pixel.
+  void SetColor(const Color& color) override;
+  void SetColorSmooth(const Color& color, uint32_t delay_ms) override;
+  Color GetColor() const override;
+
+ protected:
+  // Storage must outlive the strip, see LedStrip.
+  LedStripBase(const device* spi, std::span<PixelState> pixels, std::span<uint8_t> frame);
+  // Encodes the current state of the pixels and starts sending it, normally called from the
+  // system work queue. Frame isn't sent if SPI is not ready. Protected, so tests can time it.
+  void Render();
+
+ private:
+  static LinearColor CurrentColor(const PixelState& pixel, uint32_t now);
+  static void UpdatePixel(PixelState& pixel, const Color& color, uint32_t delay_ms, uint32_t now);
+  // Renders a frame after delay_ms, unless one is already coming.
+  void RequestFrame(uint32_t delay_ms);
+  static void RenderWorkHandler(k_work* work);
+  static void OnTransferDone(const device* dev, int result, void* data);
+
+  const device* spi_;
+  // Used by the driver during the asynchronous transfer.
+  const spi_config spi_config_;
+  spi_buf tx_buf_;
+  spi_buf_set tx_bufs_;
+
+  std::span<PixelState> pixels_;
+  std::span<uint8_t> frame_;
+  mutable k_spinlock lock_;
+  // Effect callbacks run in the ISR, which can't start SPI transfers.
+  // LedStripBase is polymorphic, so CONTAINER_OF needs a plain struct.
+  struct RenderWork {
+    k_work work;
+    LedStripBase* strip;
+  } render_work_;
+  FrameScheduler::Effect effect_;
+  atomic_t frame_pending_ = 0;
+  // Frame buffer is being read by the DMA.
+  atomic_t transferring_ = 0;
+};
+
+namespace internal {
+template <size_t kNumPixels>
+struct LedStripStorage {
+  std::array<LedStripBase::PixelState, kNumPixels> pixels;
+  std::array<uint8_t, kNumPixels * LedStripBase::kBytesPerPixel + LedStripBase::kLatchBytes> frame = {};
+};
+}  // namespace internal
+
+// Strip of kNumPixels pixels, with statically allocated state and frame buffer (12 + 20 bytes per pixel).
+template <size_t kNumPixels>
+class LedStrip : private internal::LedStripStorage<kNumPixels>, public LedStripBase {
+ public:
+  static_assert(kNumPixels > 0);
+  // Storage is the first base, so it's constructed before LedStripBase.
+  explicit LedStrip(const device* spi) : LedStripBase(spi, this->pixels, this->frame) {}
+};
+
+// One pixel of the strip, e.g. to play an animation on it with RgbLedSequencer.
+class LedStripPixel : public LedOutput {
+ public:
+  LedStripPixel(LedStripBase& strip, size_t index) : strip_(strip), index_(index) {}
+
+  void SetColor(const Color& color) override { strip_.SetPixelColor(index_, color); }
+  void SetColorSmooth(const Color& color, uint32_t delay_ms) override {
+    strip_.SetPixelColor(index_, color, delay_ms);
+  }
+  Color GetColor() const override { return strip_.GetPixelColor(index_); }
+
+ private:
+  LedStripBase& strip_;
+  const size_t index_;
+};
@@ -1,10 +1,37 @@
 #pragma once
 
+#include <array>
 #include <cstdint>
 
+// Type of the MagicPathRadioPacket in RadioPacketHeader.
+constexpr uint8_t kMagicPathBeaconType = 0x01;
+
 struct MagicPathRadioPacket {
+  static constexpr uint8_t kRadioPacketType = kMagicPathBeaconType;
+
   uint8_t id;
   Color color;
   Color background_color;
   bool configure_mode;
-} __attribute__((__packed__));
\ No newline at end of file
+} __attribute__((__packed__));
+
+// Address of the installation in RadioPacketHeader. Neighbouring installations sharing
+// the channel should use different ones, so fireflies ignore each other's activators.
+// This is the default, activators and fireflies store their own one in EEPROM and it can
+// be changed via Bluetooth ("Installation address" characteristic).
+constexpr uint8_t kMagicPathInstallationAddress = 0x01;
+
+// 0x00 and 0xFF are broadcast addresses, which every firefly accepts (see Cc1101::AddressCheck).
+constexpr bool IsValidInstallationAddress(uint8_t address) {
+  return address != 0x00 && address != 0xFF;
+}
+
+// Type of the RelayedPayload<AuthenticatedPayload<MagicPathRadioPacket>> (see RadioAuthenticator
+// and RadioRelay) in RadioPacketHeader. Fireflies only accept these, so beacons can't be spoofed
+// by anyone with a CC1101. Relays only change the hop count, which is not authenticated.
+// On-air layout and migration from the unauthenticated packets are described in README.md.
+constexpr uint8_t kMagicPathAuthenticatedBeaconType = 0x02;
+
+// Pre-shared key of the installation, fireflies and activators are flashed with the same one.
+constexpr std::array<uint8_t, 16> kMagicPathKey = {0xf5, 0xd2, 0xda, 0x3d, 0xa4, 0x2c, 0x4f, 0xdd,
+                                                   0xa7, 0x89, 0xd3, 0x1e, 0x94, 0xb3, 0x69, 0xbd};
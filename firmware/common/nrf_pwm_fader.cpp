@@ -0,0 +1,99 @@
+#include "nrf_pwm_fader.h"
+
+#include <algorithm>
+
+#include <hal/nrf_gpio.h>
+
+namespace {
+// Same as in the Zephyr nRF PWM driver: with the bit set the output is high until the compare value.
+constexpr uint16_t kPolarityFallingEdge = 0x8000;
+}
+
+NrfPwmFader::NrfPwmFader(NRF_PWM_Type* pwm, const std::array<Channel, 3>& channels, uint32_t frequency_hz)
+    : pwm_(pwm), channels_(channels), period_(kClockHz / frequency_hz), frequency_hz_(frequency_hz) {
+  // Stops whatever the driver was playing, the sequences below take over the peripheral.
+  nrf_pwm_task_trigger(pwm_, NRF_PWM_TASK_STOP);
+  nrf_pwm_int_set(pwm_, 0);
+  for (const auto& channel : channels_) {
+    const uint32_t pin = nrf_pwm_pin_get(pwm_, channel.index);
+    if (pin == NRF_PWM_PIN_NOT_CONNECTED) continue;
+    // Pin level while the PWM is stopped, LED is off.
+    nrf_gpio_pin_write(pin, channel.inverted ? 1 : 0);
+    nrf_gpio_cfg_output(pin);
+  }
+  nrf_pwm_enable(pwm_);
+  nrf_pwm_configure(pwm_, NRF_PWM_CLK_16MHz, NRF_PWM_MODE_UP, period_);
+  nrf_pwm_decoder_set(pwm_, NRF_PWM_LOAD_INDIVIDUAL, NRF_PWM_STEP_AUTO);
+  nrf_pwm_seq_end_delay_set(pwm_, 0, 0);
+  nrf_pwm_seq_end_delay_set(pwm_, 1, 0);
+}
+
+bool NrfPwmFader::Fade(const LinearColor& from, const LinearColor& to, uint32_t duration_ms) {
+  const bool needs_dither = NeedsDither(to);
+  if (duration_ms == 0 && needs_dither) {
+    Hold(to);
+    return false;
+  }
+
+  auto& buffer = buffers_[next_buffer_];
+  next_buffer_ ^= 1;
+
+  const uint32_t periods = std::max<uint32_t>(1, uint64_t(duration_ms) * frequency_hz_ / 1000);
+  const uint32_t periods_per_step = (periods + kMaxSteps - 1) / kMaxSteps;
+  const uint32_t steps = (periods + periods_per_step - 1) / periods_per_step;
+  // Step 0 (from) is what is shown now, the last one is exactly `to`.
+  for (uint32_t i = 0; i < steps; ++i) SetStep(buffer[i], Interpolate(from, to, i + 1, steps), kDitherPeriods);
+
+  nrf_pwm_seq_ptr_set(pwm_, 0, reinterpret_cast<const uint16_t*>(buffer.data()));
+  nrf_pwm_seq_cnt_set(pwm_, 0, steps * NRF_PWM_CHANNEL_COUNT);
+  nrf_pwm_seq_refresh_set(pwm_, 0, periods_per_step - 1);
+  nrf_pwm_loop_set(pwm_, 0);
+  nrf_pwm_shorts_set(pwm_, to == LinearColor{} ? NRF_PWM_SHORT_SEQEND0_STOP_MASK : 0);
+  nrf_pwm_task_trigger(pwm_, NRF_PWM_TASK_SEQSTART0);
+  return needs_dither;
+}
+
+void NrfPwmFader::Hold(const LinearColor& color) {
+  auto& buffer = dither_buffers_[next_dither_buffer_];
+  next_dither_buffer_ ^= 1;
+  for (size_t i = 0; i < kDitherPeriods; ++i) SetStep(buffer[i], color, i);
+
+  // Both sequences play the pattern and LOOPSDONE starts them over, so it loops without the CPU.
+  for (uint8_t seq = 0; seq < 2; ++seq) {
+    nrf_pwm_seq_ptr_set(pwm_, seq, reinterpret_cast<const uint16_t*>(buffer.data()));
+    nrf_pwm_seq_cnt_set(pwm_, seq, kDitherPeriods * NRF_PWM_CHANNEL_COUNT);
+    nrf_pwm_seq_refresh_set(pwm_, seq, 0);
+  }
+  nrf_pwm_loop_set(pwm_, 1);
+  nrf_pwm_shorts_set(pwm_, NRF_PWM_SHORT_LOOPSDONE_SEQSTART0_MASK);
+  nrf_pwm_task_trigger(pwm_, NRF_PWM_TASK_SEQSTART0);
+}
+
+bool NrfPwmFader::NeedsDither(const LinearColor& color) const {
+  for (const uint16_t component : {color.r, color.g, color.b}) {
+    const uint32_t duty = uint32_t(component) * period_;
+    // Fraction of the level in 1/kDitherPeriods, dithering makes no difference if it rounds to 0 or 1.
+    const uint32_t fraction = ((duty & 0xFFFF) * kDitherPeriods + 0x8000) >> 16;
+    if ((duty >> 16) < kDitherBelow && fraction != 0 && fraction != kDitherPeriods) return true;
+  }
+  return false;
+}
+
+void NrfPwmFader::SetStep(Step& step, const LinearColor& color, size_t dither_period) const {
+  const auto compare = [this, dither_period](uint16_t component, const Channel& channel) -> uint16_t {
+    // Duty cycle in PWM levels, Q16.16.
+    const uint32_t duty = uint32_t(component) * period_;
+    uint32_t level = (duty + 0x8000) >> 16;
+    if (dither_period < kDitherPeriods) {
+      // Spreads `fraction` periods with the higher level evenly over the pattern.
+      const uint32_t fraction = ((duty & 0xFFFF) * kDitherPeriods + 0x8000) >> 16;
+      const uint32_t k = dither_period;
+      level = (duty >> 16) + (k + 1) * fraction / kDitherPeriods - k * fraction / kDitherPeriods;
+    }
+    return channel.inverted ? level : level | kPolarityFallingEdge;
+  };
+  uint16_t* values = reinterpret_cast<uint16_t*>(&step);
+  values[channels_[0].index] = compare(color.r, channels_[0]);
+  values[channels_[1].index] = compare(color.g, channels_[1]);
+  values[channels_[2].index] = compare(color.b, channels_[2]);
+}
@@ -0,0 +1,62 @@
+#pragma once
+
+#include <array>
+#include <cstddef>
+#include <cstdint>
+
+#include <hal/nrf_pwm.h>
+
+#include "color.h"
+
+// Plays color fades on three channels of an nRF52 PWM instance. The whole duty cycle ramp is
+// precomputed into a RAM buffer which the PWM reads via EasyDMA (one value per channel per step),
+// so the CPU doesn't wake up until the next fade is started.
+// - PWM runs from the 16 MHz clock, so at 1 kHz a period has 16000 levels (almost 14 bits).
+// - A step lasts one or more PWM periods (SEQ[0].REFRESH), so long fades fit into kMaxSteps.
+// - Two buffers are used in turns, so a new fade doesn't overwrite the one being played.
+// - The last value is held after the sequence ends. If it's black, the PWM is stopped instead
+//   (SEQEND0 -> STOP short), so the peripheral doesn't keep the high frequency clock running.
+// - Dim levels, where a fraction of the PWM level is a noticeable part of the light, are dithered:
+//   Hold loops a pattern of kDitherPeriods periods alternating between the two closest levels.
+class NrfPwmFader {
+ public:
+  static constexpr size_t kMaxSteps = 64;
+  static constexpr uint32_t kClockHz = 16'000'000;
+  static constexpr size_t kDitherPeriods = 8;
+  // Levels from that one up are not dithered.
+  static constexpr uint32_t kDitherBelow = 64;
+
+  struct Channel {
+    // PWM channel (0-3) driving the LED.
+    uint8_t index;
+    bool inverted;
+  };
+
+  // PWM must already have its pins selected (by the Zephyr PWM driver via pinctrl).
+  // frequency_hz must be above 488 Hz, so that the period fits into the 15-bit counter.
+  NrfPwmFader(NRF_PWM_Type* pwm, const std::array<Channel, 3>& channels, uint32_t frequency_hz);
+
+  // Goes from `from` to `to` in duration_ms (0 means immediately), then holds `to`.
+  // Returns true if `to` needs dithering, i.e. Hold should be called when the fade is over.
+  bool Fade(const LinearColor& from, const LinearColor& to, uint32_t duration_ms);
+  // Shows the color until the next Fade or Hold, dithering dim components.
+  void Hold(const LinearColor& color);
+
+ private:
+  using Step = nrf_pwm_values_individual_t;
+
+  bool NeedsDither(const LinearColor& color) const;
+  // Sets compare values for the period dither_period out of kDitherPeriods. Levels are rounded
+  // to the closest one if dither_period is kDitherPeriods.
+  void SetStep(Step& step, const LinearColor& color, size_t dither_period) const;
+
+  NRF_PWM_Type* const pwm_;
+  const std::array<Channel, 3> channels_;
+  // Number of PWM levels in a period (counter top).
+  const uint16_t period_;
+  const uint32_t frequency_hz_;
+  std::array<std::array<Step, kMaxSteps>, 2> buffers_ = {};
+  uint8_t next_buffer_ = 0;
+  std::array<std::array<Step, kDitherPeriods>, 2> dither_buffers_ = {};
+  uint8_t next_dither_buffer_ = 0;
+};
@@ -0,0 +1,216 @@
+#pragma once
+
+#include <zephyr/kernel.h>
+#include <zephyr/logging/log.h>
+
+#include <algorithm>
+#include <array>
+#include <bit>
+
+#include "cc1101.h"
+#include "color.h"
+#include "magic_path_packet.h"
+
+// Mixes colors of the beacons received from up to Capacity activators within the last kWindowMs.
+// Every activator contributes its color scaled by a weight, which depends on how close it is,
+// and decays exponentially since its last beacon (see ColorMixMode for how they are mixed).
+// Contributions are added to DecayingColorMixer when a beacon is processed and removed when
+// an entry expires, so GetColor doesn't rescan the table (apart from ColorMixMode::kMax):
+// - Entries are found by (sparse, 16-bit) ID in an open addressing hash table.
+// - All entries live for kWindowMs after the last update, so deadline order is the update order,
+//   and the deadline queue is a linked list with updated entries moved to its back.
+template <size_t Capacity>
+class PacketsLog {
+  static_assert(Capacity > 0 && Capacity < 0x8000, "Unsupported capacity");
+
+ public:
+  // Packets weaker than that are most likely from far away (or noise) and are ignored.
+  static constexpr int8_t kMinRssiDbm = -95;
+  // Packets at least that strong contribute their color fully.
+  static constexpr int8_t kFullWeightRssiDbm = -60;
+  // Activator is forgotten if there were no packets from it for that long.
+  static constexpr int64_t kWindowMs = 3000;
+
+  // half_life_ms = 0 disables decay.
+  explicit PacketsLog(ColorMixMode mode = ColorMixMode::kAverage, uint32_t half_life_ms = 750)
+      : mode_(mode), mixer_(mode, half_life_ms) {
+    buckets_.fill(kNone);
+    for (size_t i = 0; i < Capacity; ++i) entries_[i].next = i + 1 < Capacity ? i + 1 : kNone;
+  }
+
+  void ProcessRadioPacket(const ReceivedRadioPacket<MagicPathRadioPacket>& received, int64_t now = k_uptime_get()) {
+    LOG_MODULE_DECLARE();
+    const auto& p = received.packet;
+    if (!received.crc_ok || received.rssi_dbm < kMinRssiDbm) {
+      LOG_DBG("Ignoring weak radio packet with ID = %d, RSSI = %d", p.id, received.rssi_dbm);
+      return;
+    }
+
+    if (p.configure_mode) {
+      const k_spinlock_key_t key = k_spin_lock(&lock_);
+      background_color_ = p.background_color;
+      k_spin_unlock(&lock_, key);
+    }
+
+    if (!Update(p.id, p.color, RssiToWeight(received.rssi_dbm), now)) {
+      LOG_WRN("Too many activators, ignoring radio packet with ID = %d", p.id);
+    }
+  }
+
+  // Adds or refreshes the entry. Returns false if the ID is new and the table is full.
+  bool Update(uint16_t id, const Color& color, WeightQ8 weight, int64_t now) {
+    const k_spinlock_key_t key = k_spin_lock(&lock_);
+    const bool updated = UpdateLocked(id, color, weight, now);
+    k_spin_unlock(&lock_, key);
+    return updated;
+  }
+
+  // Can be called from a timer (ISR) while the main thread is in Update.
+  Color GetColor(int64_t now = k_uptime_get()) {
+    const k_spinlock_key_t key = k_spin_lock(&lock_);
+    const Color color = GetColorLocked(now);
+    k_spin_unlock(&lock_, key);
+    return color;
+  }
+
+  // Number of activators seen within the window (as of the last Update or GetColor).
+  size_t size() const { return size_; }
+
+ private:
+  static constexpr uint16_t kNone = 0xFFFF;
+  // Power of 2 and at most half full, so probe sequences stay short.
+  static constexpr size_t kNumBuckets = std::bit_ceil(2 * Capacity);
+
+  struct Entry {
+    int64_t updated;
+    uint16_t id;
+    // Deadline queue links, next is also used for the list of free entries.
+    uint16_t prev, next;
+    Color color;
+    WeightQ8 weight;
+    ColorContribution contribution;
+  };
+
+  // All the methods below must be called with lock_ held.
+  bool UpdateLocked(uint16_t id, const Color& color, WeightQ8 weight, int64_t now) {
+    Expire(now);
+    if (size_ == 0) {
+      mixer_.Reset(now);
+    } else if (mixer_.NeedsRebase(now)) {
+      mixer_.Rebase(now, [this](const auto& rescale) {
+        for (uint16_t i = oldest_; i != kNone; i = entries_[i].next) rescale(entries_[i].contribution);
+      });
+    }
+    uint16_t* bucket = FindBucket(id);
+    uint16_t index = *bucket;
+    if (index == kNone) {
+      if (free_ == kNone) return false;
+      index = free_;
+      free_ = entries_[index].next;
+      entries_[index].id = id;
+      *bucket = index;
+      ++size_;
+    } else {
+      mixer_.Remove(entries_[index].contribution);
+      Unlink(index);
+    }
+
+    auto& entry = entries_[index];
+    entry.updated = now;
+    entry.color = color;
+    entry.weight = weight;
+    entry.contribution = mixer_.Add(color, weight, now);
+    PushBack(index);
+    return true;
+  }
+
+  Color GetColorLocked(int64_t now) {
+    Expire(now);
+    if (size_ == 0) {
+      return background_color_;
+    }
+
+    if (mode_ == ColorMixMode::kMax) {
+      MaxColorMixer mixer;
+      for (uint16_t i = oldest_; i != kNone; i = entries_[i].next) {
+        const auto& entry = entries_[i];
+        mixer.Add(entry.color, (entry.weight * DecayFactorQ16(now - entry.updated, mixer_.half_life_ms())) >> 16);
+      }
+      return mixer.Get();
+    }
+    return mixer_.Get(now);
+  }
+
+  static WeightQ8 RssiToWeight(int8_t rssi_dbm) {
+    const int32_t clamped = std::clamp<int32_t>(rssi_dbm, kMinRssiDbm, kFullWeightRssiDbm);
+    // Even the weakest accepted packet should be visible.
+    return 32 + (clamped - kMinRssiDbm) * (kWeightOne - 32) / (kFullWeightRssiDbm - kMinRssiDbm);
+  }
+
+  static size_t Home(uint16_t id) {
+    // Multiplicative hashing spreads consecutive IDs.
+    return (id * 40503u) & (kNumBuckets - 1);
+  }
+
+  // Bucket with the entry for the ID, or the empty one where it should be inserted.
+  uint16_t* FindBucket(uint16_t id) {
+    size_t i = Home(id);
+    while (buckets_[i] != kNone && entries_[buckets_[i]].id != id) i = (i + 1) & (kNumBuckets - 1);
+    return &buckets_[i];
+  }
+
+  // Linear probing deletion without tombstones: moves back the following entries which
+  // would become unreachable otherwise.
+  void EraseBucket(size_t i) {
+    size_t j = i;
+    while (true) {
+      j = (j + 1) & (kNumBuckets - 1);
+      if (buckets_[j] == kNone) break;
+      const size_t home = Home(entries_[buckets_[j]].id);
+      // Entry at j can stay if its home is cyclically in (i, j].
+      const bool reachable = i <= j ? (i < home && home <= j) : (i < home || home <= j);
+      if (reachable) continue;
+      buckets_[i] = buckets_[j];
+      i = j;
+    }
+    buckets_[i] = kNone;
+  }
+
+  void Expire(int64_t now) {
+    while (oldest_ != kNone && entries_[oldest_].updated + kWindowMs <= now) {
+      const uint16_t index = oldest_;
+      mixer_.Remove(entries_[index].contribution);
+      Unlink(index);
+      EraseBucket(FindBucket(entries_[index].id) - buckets_.data());
+      entries_[index].next = free_;
+      free_ = index;
+      --size_;
+    }
+  }
+
+  void Unlink(uint16_t index) {
+    auto& entry = entries_[index];
+    (entry.prev == kNone ? oldest_ : entries_[entry.prev].next) = entry.next;
+    (entry.next == kNone ? newest_ : entries_[entry.next].prev) = entry.prev;
+  }
+
+  void PushBack(uint16_t index) {
+    auto& entry = entries_[index];
+    entry.prev = newest_;
+    entry.next = kNone;
+    (newest_ == kNone ? oldest_ : entries_[newest_].next) = index;
+    newest_ = index;
+  }
+
+  // Guards everything below, GetColor is called from the timer.
+  k_spinlock lock_;
+  const ColorMixMode mode_;
+  DecayingColorMixer mixer_;
+  Color background_color_ = {0, 0, 0};
+  std::array<Entry, Capacity> entries_;
+  std::array<uint16_t, kNumBuckets> buckets_;
+  uint16_t free_ = 0;
+  uint16_t oldest_ = kNone;
+  uint16_t newest_ = kNone;
+  size_t size_ = 0;
+};
@@ -4,16 +4,12 @@
 
 template <typename T> class Persistent {
  public:
-  Persistent(uint32_t magic): magic_(magic) {}
+  // Devices with several persistent values need to put them at different (non-overlapping) EEPROM addresses.
+  Persistent(uint32_t magic, uint32_t address = 0): magic_(magic), address_(address) {}
 
   void LoadOrInit(const T& default_value) {
     eeprom::EnablePower();
-    struct Loaded {
-      uint32_t magic;
-      T value;
-    };
-
-    const auto loaded = eeprom::Read<Loaded>(0);
+    const auto loaded = eeprom::Read<Stored>(address_);
     if (loaded.magic == magic_) {
       value_ = loaded.value;
     } else {
@@ -27,10 +23,16 @@ template <typename T> class Persistent {
   }
 
   void Save() {
-    eeprom::Write(*this, 0);
+    eeprom::Write(Stored{magic_, value_}, address_);
   }
 
  private:
+  struct Stored {
+    uint32_t magic;
+    T value;
+  };
+
   const uint32_t magic_;
+  const uint32_t address_;
   T value_;
 };
@@ -0,0 +1,113 @@
+#include "power_manager.h"
+
+#include <zephyr/logging/log.h>
+#include <zephyr/sys/poweroff.h>
+
+LOG_MODULE_DECLARE();
+
+PowerManager::PowerManager(const Options& options, pw::Function<uint8_t()> measure_battery_level)
+    : options_(options), measure_battery_level_(std::move(measure_battery_level)) {
+  k_work_init_delayable(&check_work_, CheckWorkHandler);
+  k_sem_init(&transition_sem_, 0, 1);
+}
+
+PowerManager::~PowerManager() {
+  for (size_t i = 0; i < wake_buttons_count_; ++i) {
+    gpio_pin_interrupt_configure_dt(&wake_buttons_[i].spec, GPIO_INT_DISABLE);
+    gpio_remove_callback(wake_buttons_[i].spec.port, &wake_buttons_[i].callback);
+  }
+  k_work_sync sync;
+  k_work_cancel_delayable_sync(&check_work_, &sync);
+}
+
+bool PowerManager::RegisterHooks(PowerState state, pw::Function<void()> enter, pw::Function<void()> exit) {
+  if (hooks_count_ == hooks_.size()) return false;
+  hooks_[hooks_count_++] = {.state = state, .enter = std::move(enter), .exit = std::move(exit)};
+  return true;
+}
+
+bool PowerManager::AddWakeButton(const gpio_dt_spec& button) {
+  if (wake_buttons_count_ == wake_buttons_.size()) return false;
+  auto& b = wake_buttons_[wake_buttons_count_++];
+  b.spec = button;
+  b.owner = this;
+  gpio_pin_configure_dt(&b.spec, GPIO_INPUT);
+  gpio_init_callback(&b.callback, WakeButtonCallback, BIT(b.spec.pin));
+  gpio_add_callback(b.spec.port, &b.callback);
+  auto ret = gpio_pin_interrupt_configure_dt(&b.spec, GPIO_INT_EDGE_TO_ACTIVE);
+  if (ret != 0) LOG_ERR("Failed to configure wake button interrupt: %d", ret);
+  return true;
+}
+
+void PowerManager::Start() {
+  k_work_reschedule(&check_work_, K_NO_WAIT);
+}
+
+void PowerManager::WakeButtonCallback(const device* port, gpio_callback* callback, gpio_port_pins_t pins) {
+  auto* button = CONTAINER_OF(callback, WakeButton, callback);
+  k_work_reschedule(&button->owner->check_work_, K_NO_WAIT);
+}
+
+void PowerManager::CheckWorkHandler(k_work* work) {
+  auto* self = CONTAINER_OF(k_work_delayable_from_work(work), PowerManager, check_work_);
+  const uint8_t level = self->measure_battery_level_();
+  auto target = static_cast<PowerState>(atomic_get(&self->target_state_));
+  if (level != kUnknownBatteryLevel) {
+    const auto new_target = self->TargetState(level, target);
+    if (new_target != target) {
+      LOG_INF("Battery level %d%%, switching to power state %d", level, static_cast<int>(new_target));
+      target = new_target;
+      atomic_set(&self->target_state_, static_cast<atomic_val_t>(target));
+      k_sem_give(&self->transition_sem_);
+    }
+  }
+  const uint32_t period = target >= PowerState::kDeepSleep ? self->options_.deep_sleep_check_period_ms
+                                                            : self->options_.check_period_ms;
+  k_work_reschedule(&self->check_work_, K_MSEC(period));
+}
+
+PowerState PowerManager::TargetState(uint8_t level, PowerState current) const {
+  const uint8_t thresholds[] = {options_.idle_below, options_.deep_sleep_below, options_.system_off_below};
+  PowerState result = PowerState::kActive;
+  for (uint8_t i = 0; i < std::size(thresholds); ++i) {
+    const auto state = static_cast<PowerState>(i + 1);
+    // Staying in the tier (or deeper one) requires the level to get above the threshold plus hysteresis.
+    const uint32_t threshold = thresholds[i] + (current >= state ? options_.hysteresis : 0);
+    if (level < threshold) result = state;
+  }
+  return result;
+}
+
+bool PowerManager::ApplyPendingTransition() {
+  const auto target = static_cast<PowerState>(atomic_get(&target_state_));
+  if (target == state_) return false;
+
+  if (target > state_) {
+    for (size_t i = 0; i < hooks_count_; ++i) {
+      auto& h = hooks_[i];
+      if (h.state > state_ && h.state <= target && h.enter) h.enter();
+    }
+  } else {
+    for (size_t i = hooks_count_; i-- > 0;) {
+      auto& h = hooks_[i];
+      if (h.state > target && h.state <= state_ && h.exit) h.exit();
+    }
+  }
+  state_ = target;
+  if (state_ == PowerState::kSystemOff) PowerOff();
+  return true;
+}
+
+void PowerManager::AwaitTransition(k_timeout_t timeout) {
+  k_sem_take(&transition_sem_, timeout);
+}
+
+void PowerManager::PowerOff() {
+  k_work_cancel_delayable(&check_work_);
+  // Wake from System OFF is only possible via GPIO DETECT signal, which level interrupts use on nRF.
+  for (size_t i = 0; i < wake_buttons_count_; ++i) {
+    gpio_pin_interrupt_configure_dt(&wake_buttons_[i].spec, GPIO_INT_LEVEL_ACTIVE);
+  }
+  LOG_WRN("Powering off");
+  sys_poweroff();
+}
@@ -0,0 +1,94 @@
+#pragma once
+
+#include <zephyr/drivers/gpio.h>
+#include <zephyr/kernel.h>
+
+#include <array>
+
+#include "pw_function/function.h"
+
+// Power tiers, from the most to the least power hungry.
+enum class PowerState : uint8_t {
+  kActive = 0,
+  kIdle = 1,
+  kDeepSleep = 2,
+  // nRF52 System OFF: everything is off, only wake buttons can wake the device up (by resetting it).
+  kSystemOff = 3,
+};
+
+// Moves the device between power tiers based on the battery level.
+// - Battery is measured periodically in the system work queue (backed by RTC, so it keeps running
+//   in kDeepSleep, just less often). Deeper tier is entered when the level drops below its threshold,
+//   and left only after the level is back above the threshold plus hysteresis.
+// - Subsystems register enter/exit hooks for a tier. Enter hooks run (in registration order) when
+//   the device goes to that tier or deeper, exit hooks (in the reverse order) when it comes back.
+// - Hooks run in the thread calling ApplyPendingTransition, so they don't race with the code using
+//   the subsystems (e.g. the radio loop).
+// - Wake buttons trigger an immediate battery check, and are the only wake source in kSystemOff.
+class PowerManager {
+ public:
+  static constexpr size_t kMaxHooks = 8;
+  static constexpr size_t kMaxWakeButtons = 4;
+  // Returned by the measurement function if the level is not known (yet).
+  static constexpr uint8_t kUnknownBatteryLevel = 0xFF;
+
+  struct Options {
+    // Battery level (percent) thresholds of the tiers.
+    uint8_t idle_below = 20;
+    uint8_t deep_sleep_below = 10;
+    uint8_t system_off_below = 3;
+    uint8_t hysteresis = 5;
+    uint32_t check_period_ms = 5000;
+    uint32_t deep_sleep_check_period_ms = 60000;
+  };
+
+  PowerManager(const Options& options, pw::Function<uint8_t()> measure_battery_level);
+  PowerManager(const PowerManager&) = delete;
+  ~PowerManager();
+
+  // Hooks can be null.
+  bool RegisterHooks(PowerState state, pw::Function<void()> enter, pw::Function<void()> exit);
+  bool AddWakeButton(const gpio_dt_spec& button);
+
+  // Starts periodic battery checks, first one is immediate.
+  void Start();
+
+  // Runs hooks for the transition decided by the last battery check, if any. Doesn't return for kSystemOff.
+  // Returns true if the state has changed.
+  bool ApplyPendingTransition();
+  // Waits until there is a pending transition.
+  void AwaitTransition(k_timeout_t timeout);
+
+  PowerState GetState() const { return state_; }
+
+ private:
+  struct Hooks {
+    PowerState state;
+    pw::Function<void()> enter;
+    pw::Function<void()> exit;
+  };
+
+  struct WakeButton {
+    gpio_dt_spec spec;
+    gpio_callback callback;
+    PowerManager* owner;
+  };
+
+  static void CheckWorkHandler(k_work* work);
+  static void WakeButtonCallback(const device* port, gpio_callback* callback, gpio_port_pins_t pins);
+  PowerState TargetState(uint8_t level, PowerState current) const;
+  [[noreturn]] void PowerOff();
+
+  const Options options_;
+  pw::Function<uint8_t()> measure_battery_level_;
+  std::array<Hooks, kMaxHooks> hooks_;
+  size_t hooks_count_ = 0;
+  std::array<WakeButton, kMaxWakeButtons> wake_buttons_;
+  size_t wake_buttons_count_ = 0;
+
+  k_work_delayable check_work_;
+  k_sem transition_sem_;
+  // Decided by the battery check (PowerState), applied by ApplyPendingTransition.
+  atomic_t target_state_ = 0;
+  PowerState state_ = PowerState::kActive;
+};
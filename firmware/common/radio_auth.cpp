@@ -0,0 +1,33 @@
+#include "radio_auth.h"
+
+#include <zephyr/bluetooth/crypto.h>
+#include <zephyr/logging/log.h>
+
+LOG_MODULE_DECLARE();
+
+static_assert(Cc1101::kMaxPacketSize <= kMaxRadioMicPayloadSize);
+static_assert(sizeof(RadioPacketHeader) <= kMaxRadioMicHeaderSize);
+
+namespace {
+bool EncryptOnController(const RadioAuthKey& key, const uint8_t plaintext[kAesBlockSize],
+                         uint8_t ciphertext[kAesBlockSize]) {
+  const int err = bt_encrypt_be(key.data(), plaintext, ciphertext);
+  if (err) LOG_ERR("AES encryption failed: %d", err);
+  return err == 0;
+}
+}  // namespace
+
+bool RadioAuthenticator::ComputeMic(const RadioPacketHeader& header, const void* payload, size_t size,
+                                    uint32_t counter, uint8_t mic[kRadioMicSize]) const {
+  return ComputeRadioMic(EncryptOnController, key_, &header, sizeof(header), payload, size, counter, mic);
+}
+
+bool RadioAuthenticator::Verify(const RadioPacketHeader& header, const void* payload, size_t size, uint32_t counter,
+                                const uint8_t mic[kRadioMicSize]) const {
+  uint8_t expected[kRadioMicSize];
+  if (!ComputeMic(header, payload, size, counter, expected)) return false;
+  // Constant time, so MIC can't be guessed byte by byte.
+  uint8_t diff = 0;
+  for (size_t i = 0; i < kRadioMicSize; ++i) diff |= expected[i] ^ mic[i];
+  return diff == 0;
+}
@@ -0,0 +1,64 @@
+#pragma once
+
+#include <array>
+#include <cstdint>
+
+#include "radio_dispatcher.h"
+#include "radio_mic.h"
+
+// Payload of an authenticated packet. Counter must grow with every packet sent with the same
+// key by the same sender, so receivers can reject replayed packets (see RadioReplayGuard).
+template <typename PayloadT>
+struct AuthenticatedPayload {
+  PayloadT payload;
+  uint32_t counter;
+  uint8_t mic[kRadioMicSize];
+} __attribute__((__packed__));
+
+// Signs and verifies radio packets with a pre-shared key. MIC is AES-128 CBC-MAC over
+// (length, header, payload, counter), truncated to kRadioMicSize bytes (see ComputeRadioMic).
+// AES is done by bt_encrypt_be, which the Bluetooth controller runs on the ECB peripheral, so packets
+// with up to 9 bytes of payload cost a single hardware block encryption (few microseconds).
+class RadioAuthenticator {
+ public:
+  explicit RadioAuthenticator(const RadioAuthKey& key) : key_(key) {}
+
+  // Sets the counter and MIC of the payload sent with the given header.
+  template <typename PayloadT>
+  bool Sign(const RadioPacketHeader& header, AuthenticatedPayload<PayloadT>* payload, uint32_t counter) const {
+    payload->counter = counter;
+    return ComputeMic(header, &payload->payload, sizeof(PayloadT), counter, payload->mic);
+  }
+
+  // Header is passed separately, as that's what RadioPacketDispatcher handlers get
+  // (see RadioPacketInfo). Doesn't check the counter.
+  template <typename PayloadT>
+  bool Verify(const RadioPacketHeader& header, const AuthenticatedPayload<PayloadT>& payload) const {
+    return Verify(header, &payload.payload, sizeof(PayloadT), payload.counter, payload.mic);
+  }
+
+  // Returns false if the payload is too big or AES failed.
+  bool ComputeMic(const RadioPacketHeader& header, const void* payload, size_t size, uint32_t counter,
+                  uint8_t mic[kRadioMicSize]) const;
+
+ private:
+  bool Verify(const RadioPacketHeader& header, const void* payload, size_t size, uint32_t counter,
+              const uint8_t mic[kRadioMicSize]) const;
+
+  const RadioAuthKey key_;
+};
+
+// Rejects replayed packets: packet from a sender is accepted only if its counter is bigger than
+// counters of all the previously accepted ones. Senders are identified by index (e.g. activator ID).
+template <size_t NumSenders>
+class RadioReplayGuard {
+ public:
+  bool Accept(size_t sender, uint32_t counter) {
+    if (sender >= NumSenders || counter < min_counters_[sender]) return false;
+    min_counters_[sender] = counter + 1;
+    return true;
+  }
+
+ private:
+  std::array<uint32_t, NumSenders> min_counters_ = {};
+};
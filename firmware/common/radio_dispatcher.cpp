@@ -0,0 +1,49 @@
+#include "radio_dispatcher.h"
+
+#include <algorithm>
+
+LOG_MODULE_DECLARE();
+
+bool RadioPacketDispatcher::Register(uint8_t type, uint8_t payload_size, RawHandler handler) {
+  if (entries_count_ == entries_.size()) return false;
+  for (size_t i = 0; i < entries_count_; ++i) {
+    if (entries_[i].type == type) return false;
+  }
+  entries_[entries_count_++] = {.type = type, .payload_size = payload_size, .handler = std::move(handler)};
+  return true;
+}
+
+uint8_t RadioPacketDispatcher::GetMaxPacketSize() const {
+  uint8_t result = 0;
+  for (size_t i = 0; i < entries_count_; ++i) {
+    result = std::max<uint8_t>(result, sizeof(RadioPacketHeader) + entries_[i].payload_size);
+  }
+  return result;
+}
+
+bool RadioPacketDispatcher::Dispatch(const Cc1101::RawReceivedPacket& packet) {
+  if (!packet.crc_ok || packet.size < sizeof(RadioPacketHeader)) return false;
+
+  RadioPacketHeader header;
+  memcpy(&header, packet.data, sizeof(header));
+  for (size_t i = 0; i < entries_count_; ++i) {
+    auto& entry = entries_[i];
+    if (entry.type != header.type) continue;
+    if (packet.size != sizeof(RadioPacketHeader) + entry.payload_size) {
+      LOG_WRN("Packet of type %d has unexpected size %d", header.type, packet.size);
+      return false;
+    }
+    const RadioPacketInfo info = {.address = header.address, .rssi_dbm = packet.rssi_dbm, .lqi = packet.lqi};
+    entry.handler(packet.data + sizeof(RadioPacketHeader), info);
+    return true;
+  }
+
+  LOG_DBG("No handler for packet type %d", header.type);
+  return false;
+}
+
+bool RadioPacketDispatcher::AwaitAndDispatch(Cc1101& cc1101, uint32_t timeout_ms) {
+  Cc1101::RawReceivedPacket packet;
+  if (!cc1101.AwaitRawPacket(timeout_ms, &packet)) return false;
+  return Dispatch(packet);
+}
@@ -0,0 +1,112 @@
+#pragma once
+
+#include <array>
+#include <cstring>
+#include <variant>
+
+#include "cc1101.h"
+#include "pw_function/function.h"
+
+// First bytes of every packet handled by RadioPacketDispatcher. Address must go first,
+// as that's the byte checked by the radio address filtering (see Cc1101::SetAddressFilter).
+struct RadioPacketHeader {
+  // Installation (group) the packet is for, 0x00 and 0xFF are broadcast.
+  uint8_t address;
+  uint8_t type;
+} __attribute__((__packed__));
+
+template <typename PayloadT>
+struct TypedRadioPacket {
+  RadioPacketHeader header;
+  PayloadT payload;
+} __attribute__((__packed__));
+
+// Everything about the received packet apart from its payload.
+struct RadioPacketInfo {
+  uint8_t address;
+  int8_t rssi_dbm;
+  uint8_t lqi;
+};
+
+// Maps a packet type byte to the payload size and a handler, so several kinds of packets can be
+// received in one session.
+class RadioPacketDispatcher {
+ public:
+  static constexpr size_t kMaxPacketTypes = 8;
+
+  // Registers handler(const PayloadT&, const RadioPacketInfo&) for packets of the given type.
+  // Returns false if the type is already registered or there is no room for it.
+  template <typename PayloadT, typename Handler>
+  bool Register(uint8_t type, Handler handler) {
+    static_assert(sizeof(TypedRadioPacket<PayloadT>) <= Cc1101::kMaxPacketSize, "Packet is too big");
+    return Register(type, sizeof(PayloadT), [handler](const uint8_t* data, const RadioPacketInfo& info) mutable {
+      PayloadT payload;
+      memcpy(&payload, data, sizeof(PayloadT));
+      handler(payload, info);
+    });
+  }
+
+  // Size (including the header) of the largest registered packet.
+  uint8_t GetMaxPacketSize() const;
+
+  // Calls a handler registered for the packet type. Returns false if there is none,
+  // or the packet is malformed (e.g. has unexpected size).
+  bool Dispatch(const Cc1101::RawReceivedPacket& packet);
+
+  // Waits up to timeout_ms for a packet received by armed cc1101 (see Cc1101::StartReceive)
+  // and dispatches it.
+  bool AwaitAndDispatch(Cc1101& cc1101, uint32_t timeout_ms);
+
+ private:
+  using RawHandler = pw::Function<void(const uint8_t* payload, const RadioPacketInfo& info)>;
+
+  struct Entry {
+    uint8_t type;
+    uint8_t payload_size;
+    RawHandler handler;
+  };
+
+  bool Register(uint8_t type, uint8_t payload_size, RawHandler handler);
+
+  std::array<Entry, kMaxPacketTypes> entries_;
+  size_t entries_count_ = 0;
+};
+
+// Stores the payload of a received packet in *result as whichever of PayloadTs it is. Every payload
+// type must define `static constexpr uint8_t kRadioPacketType`. Returns false for packets of other
+// types or sizes, and for the ones with bad CRC.
+template <typename... PayloadTs>
+bool ParseAnyPacket(const Cc1101::RawReceivedPacket& packet, std::variant<PayloadTs...>* result,
+                    RadioPacketInfo* info = nullptr) {
+  LOG_MODULE_DECLARE();
+  static_assert(((sizeof(TypedRadioPacket<PayloadTs>) <= Cc1101::kMaxPacketSize) && ...), "Packet is too big");
+  if (!packet.crc_ok || packet.size < sizeof(RadioPacketHeader)) return false;
+
+  RadioPacketHeader header;
+  memcpy(&header, packet.data, sizeof(header));
+  const auto try_parse = [&]<typename PayloadT>() {
+    if (header.type != PayloadT::kRadioPacketType) return false;
+    if (packet.size != sizeof(TypedRadioPacket<PayloadT>)) return false;
+    PayloadT payload;
+    memcpy(&payload, packet.data + sizeof(RadioPacketHeader), sizeof(PayloadT));
+    result->template emplace<PayloadT>(payload);
+    return true;
+  };
+  if (!(try_parse.template operator()<PayloadTs>() || ...)) {
+    LOG_DBG("Unexpected packet of type %d and size %d", header.type, packet.size);
+    return false;
+  }
+  if (info) *info = {.address = header.address, .rssi_dbm = packet.rssi_dbm, .lqi = packet.lqi};
+  return true;
+}
+
+// Waits up to timeout_ms for a packet received by armed cc1101 and parses it (see ParseAnyPacket).
+// With several payload sizes, cc1101 must be in variable packet length mode (see Cc1101::SetPacketLength)
+// and armed for the largest one.
+template <typename... PayloadTs>
+bool AwaitAnyPacket(Cc1101& cc1101, uint32_t timeout_ms, std::variant<PayloadTs...>* result,
+                    RadioPacketInfo* info = nullptr) {
+  Cc1101::RawReceivedPacket packet;
+  if (!cc1101.AwaitRawPacket(timeout_ms, &packet)) return false;
+  return ParseAnyPacket(packet, result, info);
+}
@@ -0,0 +1,31 @@
+#include "radio_mic.h"
+
+#include <cstring>
+
+namespace {
+// Size byte, header, payload and counter.
+constexpr size_t kMaxMessageSize = 1 + kMaxRadioMicHeaderSize + kMaxRadioMicPayloadSize + sizeof(uint32_t);
+}  // namespace
+
+bool ComputeRadioMic(AesEncryptBlock encrypt, const RadioAuthKey& key, const void* header, size_t header_size,
+                     const void* payload, size_t size, uint32_t counter, uint8_t mic[kRadioMicSize]) {
+  if (header_size > kMaxRadioMicHeaderSize || size > kMaxRadioMicPayloadSize) return false;
+
+  uint8_t message[(kMaxMessageSize + kAesBlockSize - 1) / kAesBlockSize * kAesBlockSize] = {};
+  size_t message_size = 0;
+  message[message_size++] = size;
+  memcpy(message + message_size, header, header_size);
+  message_size += header_size;
+  memcpy(message + message_size, payload, size);
+  message_size += size;
+  for (size_t i = 0; i < sizeof(counter); ++i) message[message_size++] = counter >> (8 * i);
+
+  uint8_t state[kAesBlockSize] = {};
+  for (size_t offset = 0; offset < message_size; offset += kAesBlockSize) {
+    uint8_t block[kAesBlockSize];
+    for (size_t i = 0; i < kAesBlockSize; ++i) block[i] = state[i] ^ message[offset + i];
+    if (!encrypt(key, block, state)) return false;
+  }
+  memcpy(mic, state, kRadioMicSize);
+  return true;
+}
@@ -0,0 +1,28 @@
+#pragma once
+
+#include <array>
+#include <cstddef>
+#include <cstdint>
+
+// Message integrity code of authenticated radio packets (see RadioAuthenticator), independent of
+// the AES implementation, so it's tested on the host too (see host_test).
+
+// Size of the (truncated) message integrity code appended to authenticated packets.
+constexpr size_t kRadioMicSize = 4;
+constexpr size_t kAesBlockSize = 16;
+// Largest header and payload ComputeRadioMic accepts.
+constexpr size_t kMaxRadioMicHeaderSize = 4;
+constexpr size_t kMaxRadioMicPayloadSize = 32;
+
+using RadioAuthKey = std::array<uint8_t, 16>;
+
+// AES-128 encryption of a single block, returns false if it failed.
+using AesEncryptBlock = bool (*)(const RadioAuthKey& key, const uint8_t plaintext[kAesBlockSize],
+                                 uint8_t ciphertext[kAesBlockSize]);
+
+// AES-128 CBC-MAC (zero IV) over (payload size byte, header, payload, counter as 4 bytes little endian),
+// zero-padded to the whole number of blocks and truncated to kRadioMicSize bytes. Leading size byte
+// makes CBC-MAC secure for messages of different lengths.
+// Returns false if the header or payload is too big or encryption failed.
+bool ComputeRadioMic(AesEncryptBlock encrypt, const RadioAuthKey& key, const void* header, size_t header_size,
+                     const void* payload, size_t size, uint32_t counter, uint8_t mic[kRadioMicSize]);
@@ -0,0 +1,11 @@
+#include "radio_relay.h"
+
+#include <algorithm>
+
+bool RecentPacketCache::Insert(uint32_t key) {
+  if (std::find(keys_.begin(), keys_.begin() + size_, key) != keys_.begin() + size_) return false;
+  keys_[next_] = key;
+  next_ = (next_ + 1) % kCapacity;
+  size_ = std::min(size_ + 1, kCapacity);
+  return true;
+}
@@ -0,0 +1,95 @@
+#pragma once
+
+#include <zephyr/kernel.h>
+#include <zephyr/logging/log.h>
+#include <zephyr/random/random.h>
+
+#include <array>
+
+#include "cc1101.h"
+#include "radio_dispatcher.h"
+
+// Payload of a packet which can be relayed: original payload and how many times it was relayed
+// so far (0 when sent by the original transmitter). Relayed packets keep the size and type,
+// so they can be received in the same session (even with fixed packet length).
+template <typename PayloadT>
+struct RelayedPayload {
+  uint8_t hops;
+  PayloadT payload;
+} __attribute__((__packed__));
+
+// Identifies a packet by its sender and sequence number (e.g. activator ID and counter).
+constexpr uint32_t RecentPacketKey(uint8_t sender, uint32_t sequence) {
+  // Fibonacci hashing spreads consecutive sequence numbers, sender goes to the low byte.
+  return (sequence * 2654435761u) ^ sender;
+}
+
+// Fixed-size cache of keys (see RecentPacketKey) of recently seen packets.
+// Oldest key is evicted when it's full.
+class RecentPacketCache {
+ public:
+  static constexpr size_t kCapacity = 16;
+
+  // Returns false if the key is already in the cache, otherwise adds it.
+  bool Insert(uint32_t key);
+
+ private:
+  std::array<uint32_t, kCapacity> keys_ = {};
+  size_t size_ = 0;
+  size_t next_ = 0;
+};
+
+// Rebroadcasts received packets, so they reach receivers out of the original transmitter's range.
+// Every packet is relayed at most once by each relay (see RecentPacketCache) and at most max_hops
+// times in total, which keeps the airtime bounded. Each retransmission is delayed by a random
+// jitter, so relays which heard the same packet don't collide, and listen-before-talk
+// (see Cc1101::TransmitIfChannelClear) lets the later ones hear the earlier ones.
+template <typename PayloadT>
+class RadioRelay {
+ public:
+  using Packet = TypedRadioPacket<RelayedPayload<PayloadT>>;
+  static constexpr size_t kQueueSize = 4;
+
+  struct Options {
+    uint8_t max_hops = 2;
+    uint32_t max_jitter_ms = 10;
+  };
+
+  RadioRelay(Cc1101& cc1101, const Options& options) : cc1101_(cc1101), options_(options) {}
+
+  // Queues a received packet for rebroadcast with the same header and incremented hop count.
+  // Returns false if the packet was already seen, ran out of hops or queue is full.
+  bool Enqueue(const RadioPacketHeader& header, const RelayedPayload<PayloadT>& payload, uint32_t key) {
+    LOG_MODULE_DECLARE();
+    if (!recent_.Insert(key)) return false;
+    if (payload.hops >= options_.max_hops) return false;
+    if (queue_size_ == queue_.size()) {
+      LOG_WRN("Relay queue is full, dropping packet");
+      return false;
+    }
+    auto& p = queue_[queue_size_++];
+    p.header = header;
+    p.payload = payload;
+    ++p.payload.hops;
+    return true;
+  }
+
+  // Transmits queued packets on the current channel. Radio must not be receiving
+  // (see Cc1101::StopReceive). Returns the number of packets sent.
+  size_t Flush() {
+    size_t sent = 0;
+    for (size_t i = 0; i < queue_size_; ++i) {
+      k_sleep(K_MSEC(sys_rand32_get() % (options_.max_jitter_ms + 1)));
+      if (cc1101_.TransmitIfChannelClear(queue_[i])) ++sent;
+    }
+    queue_size_ = 0;
+    return sent;
+  }
+
+ private:
+  Cc1101& cc1101_;
+  const Options options_;
+  RecentPacketCache recent_;
+  std::array<Packet, kQueueSize> queue_;
+  size_t queue_size_ = 0;
+};
@@ -4,17 +4,8 @@
 #include <zephyr/drivers/gpio.h>
 
 namespace {
-const uint32_t kFrequencyHertz = 50;
-const uint32_t kUsecPerSecond = 1000 * 1000;
-const uint32_t kCyclePeriodUs = kUsecPerSecond / kFrequencyHertz;
-
-uint32_t colorComponentToPulseWidth(uint8_t component) {
-  return (kCyclePeriodUs / 255u) * component;
-}
-
-}
-
-RgbLed::RgbLed(): timer_([this](){ this->OnTimer(); }) {
+// Well above the flicker fusion threshold.
+const uint32_t kFrequencyHertz = 1000;
 }
 
 void RgbLed::EnablePowerStabilizer() {
@@ -25,58 +16,171 @@ void RgbLed::DisablePowerStabilizer() {
   gpio_pin_set_dt(&device_stabilizer_spec_, 0);
 }
 
+#if RGB_LED_HARDWARE_FADE
+
+#define RGB_LED_CHANNEL(alias) \
+  NrfPwmFader::Channel{DT_PWMS_CHANNEL(DT_ALIAS(alias)), (DT_PWMS_FLAGS(DT_ALIAS(alias)) & PWM_POLARITY_INVERTED) != 0}
+
+RgbLed::RgbLed()
+    : fader_(reinterpret_cast<NRF_PWM_Type*>(DT_REG_ADDR(DT_PWMS_CTLR(DT_ALIAS(led_r)))),
+             {{RGB_LED_CHANNEL(led_r), RGB_LED_CHANNEL(led_g), RGB_LED_CHANNEL(led_b)}}, kFrequencyHertz),
+      effect_([this]() { fader_.Hold(ToLinear(target_color_)); }) {
+}
+
 void RgbLed::SetColor(const Color& color) {
-  color_ = color;
+  SetColorSmooth(color, 0);
+}
+
+Color RgbLed::GetColor() const {
+  const int64_t elapsed = k_uptime_get() - fade_start_ms_;
+  if (elapsed >= fade_duration_ms_) return target_color_;
+  return FromLinear(Interpolate(fade_from_, ToLinear(target_color_), elapsed, fade_duration_ms_));
+}
+
+void RgbLed::SetColorSmooth(const Color& color, uint32_t delay_ms) {
+  const int64_t now = k_uptime_get();
+  fade_from_ = Interpolate(fade_from_, ToLinear(target_color_), now - fade_start_ms_, fade_duration_ms_);
   target_color_ = color;
-  timer_period_ = 0;
-  timer_.Cancel();
-  ActuateColor();
+  fade_start_ms_ = now;
+  fade_duration_ms_ = delay_ms;
+  effect_.Cancel();
+  // Fade is played in linear light, same as GetColor interpolates.
+  if (fader_.Fade(fade_from_, ToLinear(target_color_), delay_ms)) effect_.RunDelayed(delay_ms);
 }
 
-const Color& RgbLed::GetColor() const {
-  return color_;
+#else
+
+#define RGB_LED_CHANNEL(alias) \
+  Channel{DEVICE_DT_GET(DT_PWMS_CTLR(DT_ALIAS(alias))), DT_PWMS_CHANNEL(DT_ALIAS(alias)), DT_PWMS_FLAGS(DT_ALIAS(alias))}
+
+RgbLed::RgbLed()
+    : channels_{{RGB_LED_CHANNEL(led_r), RGB_LED_CHANNEL(led_g), RGB_LED_CHANNEL(led_b)}},
+      effect_([this]() { OnTimer(); }) {
+  for (auto& channel : channels_) {
+    uint64_t cycles_per_sec = 0;
+    pwm_get_cycles_per_sec(channel.dev, channel.index, &cycles_per_sec);
+    channel.period_cycles = cycles_per_sec / kFrequencyHertz;
+  }
 }
 
-void RgbLed::ActuateColor() {
-  pwm_set(device_r_, DT_PWMS_CHANNEL(DT_ALIAS(led_r)),
-    PWM_USEC(kCyclePeriodUs), PWM_USEC(colorComponentToPulseWidth(color_.r)), DT_PWMS_FLAGS(DT_ALIAS(led_r)));
-  pwm_set(device_g_, DT_PWMS_CHANNEL(DT_ALIAS(led_g)),
-    PWM_USEC(kCyclePeriodUs), PWM_USEC(colorComponentToPulseWidth(color_.g)), DT_PWMS_FLAGS(DT_ALIAS(led_g)));
-  pwm_set(device_b_, DT_PWMS_CHANNEL(DT_ALIAS(led_b)),
-    PWM_USEC(kCyclePeriodUs), PWM_USEC(colorComponentToPulseWidth(color_.b)), DT_PWMS_FLAGS(DT_ALIAS(led_b)));
+bool RgbLed::Channel::Set(uint16_t linear) {
+  // Amount of light is proportional to the pulse width. Q16.16 levels.
+  const uint64_t duty = (uint64_t(linear) * period_cycles << 16) / 0xFFFF;
+  uint32_t level = duty >> 16;
+  const bool dither = level < kDitherBelow && (duty & 0xFFFF) != 0;
+  if (dither) {
+    dither_error += duty & 0xFFFF;
+    if (dither_error >= 0x10000) {
+      dither_error -= 0x10000;
+      ++level;
+    }
+  } else {
+    dither_error = 0;
+  }
+  pwm_set_cycles(dev, index, period_cycles, level, flags);
+  return dither;
+}
+
+void RgbLed::SetColor(const Color& color) {
+  SetColorSmooth(color, 0);
+}
+
+Color RgbLed::GetColor() const {
+  const int64_t elapsed = k_uptime_get() - fade_start_ms_;
+  if (elapsed >= fade_duration_ms_) return target_color_;
+  return FromLinear(Interpolate(fade_from_, ToLinear(target_color_), elapsed, fade_duration_ms_));
 }
 
 void RgbLed::SetColorSmooth(const Color& color, uint32_t delay_ms) {
+  const int64_t now = k_uptime_get();
+  fade_from_ = Interpolate(fade_from_, ToLinear(target_color_), now - fade_start_ms_, fade_duration_ms_);
   target_color_ = color;
-  timer_period_ = color_.DelayToTheNextAdjustment(target_color_, delay_ms);
-  timer_.RunDelayed(timer_period_);
+  fade_start_ms_ = now;
+  fade_duration_ms_ = delay_ms;
+  effect_.Cancel();
+  OnTimer();
 }
 
 void RgbLed::OnTimer() {
-  color_.Adjust(target_color_);
-  ActuateColor();
-  if (color_ != target_color_) timer_.RunDelayed(timer_period_);
+  const int64_t elapsed = k_uptime_get() - fade_start_ms_;
+  const LinearColor color = Interpolate(fade_from_, ToLinear(target_color_), elapsed, fade_duration_ms_);
+  // Not short-circuited, all channels must be set.
+  const bool dither = channels_[0].Set(color.r) | channels_[1].Set(color.g) | channels_[2].Set(color.b);
+  if (elapsed < fade_duration_ms_ || dither) effect_.RunDelayed(FrameScheduler::kTickMs);
 }
 
+#endif
+
 
-RgbLedSequencer::RgbLedSequencer(RgbLed& led): led_(led), timer_([this](){ this->EndChunk(); }) {
+RgbLedSequencer::RgbLedSequencer(LedOutput& led): led_(led), effect_([this](){ this->Run(); }) {
 }
 
-void RgbLedSequencer::StartOrRestart(const LedChunk* sequence) {
-  timer_.Cancel();
-  current_ = sequence;
-  StartChunk();
+void RgbLedSequencer::StartOrRestart(std::span<const uint8_t> animation) {
+  Stop();
+  animation_ = animation;
+  pc_ = 0;
+  loop_depth_ = 0;
+  Run();
 }
 
-void RgbLedSequencer::StartChunk() {
-  if (current_->type == LedChunkType::Finish) return;
-  if (current_->type == LedChunkType::SetColor) {
-    led_.SetColorSmooth(current_->color, current_->time_ms);
+void RgbLedSequencer::Stop() {
+  effect_.Cancel();
+  atomic_set(&awaited_events_, 0);
+  animation_ = {};
+}
+
+void RgbLedSequencer::Signal(uint8_t events) {
+  if (atomic_get(&awaited_events_) & events) {
+    atomic_set(&awaited_events_, 0);
+    effect_.RunDelayed(0);
   }
-  timer_.RunDelayed(current_->time_ms);
 }
 
-void RgbLedSequencer::EndChunk() {
-  ++current_;
-  StartChunk();
+void RgbLedSequencer::Run() {
+  using led_animation::Op;
+  using led_animation::ReadU16;
+  if (animation_.empty()) return;
+  for (uint32_t i = 0; i < kMaxInstructionsPerRun; ++i) {
+    const uint8_t* p = &animation_[pc_];
+    const size_t next = pc_ + led_animation::InstructionSize(p[0]);
+    switch (static_cast<Op>(p[0])) {
+      case Op::kEnd:
+        return;
+      case Op::kSet:
+        led_.SetColor({p[1], p[2], p[3]});
+        pc_ = next;
+        break;
+      case Op::kRamp:
+        led_.SetColorSmooth({p[1], p[2], p[3]}, ReadU16(p + 4));
+        pc_ = next;
+        effect_.RunDelayed(ReadU16(p + 4));
+        return;
+      case Op::kWait:
+        pc_ = next;
+        effect_.RunDelayed(ReadU16(p + 1));
+        return;
+      case Op::kLoop:
+        loops_[loop_depth_++] = {.start = uint16_t(next), .remaining = p[1] == 0 ? kForever : uint16_t(p[1])};
+        pc_ = next;
+        break;
+      case Op::kEndLoop: {
+        auto& loop = loops_[loop_depth_ - 1];
+        if (loop.remaining == kForever || --loop.remaining > 0) {
+          pc_ = loop.start;
+        } else {
+          --loop_depth_;
+          pc_ = next;
+        }
+        break;
+      }
+      case Op::kJump:
+        pc_ = ReadU16(p + 1);
+        break;
+      case Op::kWaitEvent:
+        pc_ = next;
+        atomic_set(&awaited_events_, p[1]);
+        return;
+    }
+  }
+  effect_.RunDelayed(1);
 }
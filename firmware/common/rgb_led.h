@@ -1,7 +1,9 @@
 #pragma once
 
+#include <array>
 #include <cstdint>
 #include <functional>
+#include <span>
 #include <string_view>
 
 #include <zephyr/drivers/pwm.h>
@@ -9,46 +11,105 @@
 #include <zephyr/drivers/gpio.h>
 
 #include "color.h"
-#include "timer.h"
+#include "frame_scheduler.h"
+#include "led_animation.h"
+#include "led_output.h"
 #include "sequences.h"
 
-class RgbLed {
+// Color components are perceptual (see LinearColor), they are converted to light intensity on output.
+// On nRF52, if all three LEDs are on the same PWM instance, fades are played by the PWM itself
+// (see NrfPwmFader) in linear light. Otherwise the timer sets the PWM every frame, interpolating in linear
+// light the same way.
+#if DT_NODE_HAS_COMPAT(DT_PWMS_CTLR(DT_ALIAS(led_r)), nordic_nrf_pwm) && \
+    DT_SAME_NODE(DT_PWMS_CTLR(DT_ALIAS(led_r)), DT_PWMS_CTLR(DT_ALIAS(led_g))) && \
+    DT_SAME_NODE(DT_PWMS_CTLR(DT_ALIAS(led_r)), DT_PWMS_CTLR(DT_ALIAS(led_b)))
+#define RGB_LED_HARDWARE_FADE 1
+#include "nrf_pwm_fader.h"
+#endif
+
+class RgbLed : public LedOutput {
 public:
   RgbLed();
 
-  void EnablePowerStabilizer();
-  void DisablePowerStabilizer();
-  void SetColor(const Color& color);
-  const Color& GetColor() const;
-  void SetColorSmooth(const Color& color, uint32_t delay_ms);
+  void EnablePowerStabilizer() override;
+  void DisablePowerStabilizer() override;
+  void SetColor(const Color& color) override;
+  Color GetColor() const override;
+  void SetColorSmooth(const Color& color, uint32_t delay_ms) override;
 private:
-  // Changes color of the physical LED to the color_.
-  void ActuateColor();
+  const gpio_dt_spec device_stabilizer_spec_ = GPIO_DT_SPEC_GET(DT_ALIAS(led_en), gpios);
+#if RGB_LED_HARDWARE_FADE
+  NrfPwmFader fader_;
+  LinearColor fade_from_;
+  Color target_color_ = {0, 0, 0};
+  int64_t fade_start_ms_ = 0;
+  uint32_t fade_duration_ms_ = 0;
+  // Starts dithering the target color when the fade is over.
+  FrameScheduler::Effect effect_;
+#else
+  // One LED on a PWM channel. Dim levels, where a fraction of the PWM level is a noticeable part of the light,
+  // are dithered across frames: the fraction is accumulated and the level is bumped by one when it overflows.
+  struct Channel {
+    const device* dev;
+    uint32_t index;
+    pwm_flags_t flags;
+    // Number of PWM levels in a period.
+    uint32_t period_cycles = 0;
+    // Q0.16 fraction of a level carried over to the next frame.
+    uint32_t dither_error = 0;
+
+    // Returns true if the level is dithered, i.e. Set should be called again on the next frame.
+    bool Set(uint16_t linear);
+  };
+
+  // Levels from that one up are not dithered.
+  static constexpr uint32_t kDitherBelow = 64;
+
+  // Renders the current point of the fade, reschedules itself while fading or dithering.
   void OnTimer();
 
-  Color color_ = {0, 0, 0};
+  LinearColor fade_from_;
   Color target_color_ = {0, 0, 0};
-  uint32_t timer_period_ = 0;
-  const device* device_r_ = DEVICE_DT_GET(DT_PWMS_CTLR(DT_ALIAS(led_r)));
-  const device* device_g_ = DEVICE_DT_GET(DT_PWMS_CTLR(DT_ALIAS(led_g)));
-  const device* device_b_ = DEVICE_DT_GET(DT_PWMS_CTLR(DT_ALIAS(led_b)));
-  const gpio_dt_spec device_stabilizer_spec_ = GPIO_DT_SPEC_GET(DT_ALIAS(led_en), gpios);
-  Timer timer_;
+  int64_t fade_start_ms_ = 0;
+  uint32_t fade_duration_ms_ = 0;
+  std::array<Channel, 3> channels_;
+  FrameScheduler::Effect effect_;
+#endif
 };
 
 
+// Plays led_animation bytecode on any LedOutput. Instructions run in the timer callback until the one which takes time,
+// and the state is just a program counter and a fixed loop stack, so nothing is allocated.
 class RgbLedSequencer {
 public:
-  RgbLedSequencer(RgbLed& led);
+  RgbLedSequencer(LedOutput& led);
 
-  void StartOrRestart(const LedChunk* sequence);
+  // Animation must be valid (see led_animation::Validate) and must outlive the playback.
+  void StartOrRestart(std::span<const uint8_t> animation);
+  void Stop();
+  // Resumes the animation if it waits for any of the events.
+  void Signal(uint8_t events);
 
 private:
-  void StartChunk();
-  void EndChunk();
+  // Animations without waits (e.g. loops of kSet) yield after that many instructions.
+  static constexpr uint32_t kMaxInstructionsPerRun = 64;
+
+  struct Loop {
+    // Offset of the first instruction of the body.
+    uint16_t start;
+    // kForever for endless loops.
+    uint16_t remaining;
+  };
+  static constexpr uint16_t kForever = 0xFFFF;
+
+  void Run();
 
-  RgbLed& led_;
-  Timer timer_;
-  const LedChunk* current_ = nullptr;
+  LedOutput& led_;
+  FrameScheduler::Effect effect_;
+  std::span<const uint8_t> animation_;
+  size_t pc_ = 0;
+  std::array<Loop, led_animation::kMaxLoopDepth> loops_;
+  size_t loop_depth_ = 0;
+  atomic_t awaited_events_ = 0;
 };
 
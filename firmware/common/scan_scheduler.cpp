@@ -0,0 +1,46 @@
+#include "scan_scheduler.h"
+
+#include <algorithm>
+
+namespace {
+// Hit rate is an exponential moving average with that weight of the latest dwell (as a power of 2).
+const uint8_t kHitRateShift = 2;
+
+uint32_t Interpolate(uint32_t from, uint32_t to, uint16_t rate) {
+  return from + (to - from) * rate / ScanScheduler::kMaxHitRate;
+}
+}  // namespace
+
+ScanScheduler::Dwell ScanScheduler::NextDwell() {
+  Dwell dwell = {.idle_before_ms = 0, .channel = channel_};
+  if (channel_ == 0) {
+    // New cycle starts.
+    dwell.idle_before_ms = StretchForBattery(idle_ms_);
+  }
+  const uint16_t rate = hit_rates_[channel_];
+  dwell.duration_ms = Interpolate(options_.min_dwell_ms, options_.max_dwell_ms, rate);
+  dwell.listen_after_hit_ms = Interpolate(options_.min_listen_after_hit_ms, options_.max_listen_after_hit_ms, rate);
+  return dwell;
+}
+
+void ScanScheduler::ReportDwell(bool heard_something) {
+  auto& rate = hit_rates_[channel_];
+  rate = rate - (rate >> kHitRateShift) + (heard_something ? kMaxHitRate >> kHitRateShift : 0);
+  cycle_had_hits_ |= heard_something;
+  if (heard_something) idle_ms_ = 0;
+
+  channel_ = (channel_ + 1) % std::min(options_.num_channels, kMaxChannels);
+  if (channel_ == 0) {
+    if (!cycle_had_hits_) {
+      idle_ms_ = std::clamp(2 * idle_ms_, options_.min_idle_ms, options_.max_idle_ms);
+    }
+    cycle_had_hits_ = false;
+  }
+}
+
+uint32_t ScanScheduler::StretchForBattery(uint32_t ms) const {
+  const uint32_t level = std::min<uint32_t>(atomic_get(&battery_level_), options_.low_battery_level);
+  const uint32_t threshold = std::max<uint32_t>(options_.low_battery_level, 1);
+  // Linear from 1x at low_battery_level to kMaxBatteryStretch at 0%.
+  return ms + ms * (kMaxBatteryStretch - 1) * (threshold - level) / threshold;
+}
@@ -0,0 +1,61 @@
+#pragma once
+
+#include <zephyr/kernel.h>
+
+#include <array>
+
+// Decides which channel a receiver listens to next and for how long, trading latency against energy:
+// - Channels are scanned round-robin, active ones (with a high recent hit rate) are listened to longer.
+// - After a scan cycle without any hits, receiver sleeps for an idle gap, which doubles with every
+//   quiet cycle (up to the maximum) and drops back to zero after a hit.
+// - At low battery, idle gaps are stretched up to kMaxBatteryStretch times.
+class ScanScheduler {
+ public:
+  static constexpr uint8_t kMaxChannels = 8;
+  static constexpr uint32_t kMaxBatteryStretch = 4;
+
+  struct Options {
+    uint8_t num_channels = 4;
+    // How long to wait for the first packet on a quiet and on the most active channel.
+    uint32_t min_dwell_ms;
+    uint32_t max_dwell_ms;
+    // How long to keep listening after the first packet on a quiet and on the most active channel.
+    uint32_t min_listen_after_hit_ms;
+    uint32_t max_listen_after_hit_ms;
+    // Idle gap after the first quiet cycle, and the limit it grows to.
+    uint32_t min_idle_ms;
+    uint32_t max_idle_ms;
+    // Below that battery level (percent), idle gaps are stretched, up to kMaxBatteryStretch at 0%.
+    uint8_t low_battery_level = 50;
+  };
+
+  struct Dwell {
+    // Sleep for that long before switching to the channel.
+    uint32_t idle_before_ms;
+    uint8_t channel;
+    uint32_t duration_ms;
+    uint32_t listen_after_hit_ms;
+  };
+
+  explicit ScanScheduler(const Options& options) : options_(options) {}
+
+  Dwell NextDwell();
+  // Reports whether anything was received during the dwell returned by the last NextDwell.
+  void ReportDwell(bool heard_something);
+  // Can be called from any thread, e.g. by a battery monitoring timer.
+  void SetBatteryLevel(uint8_t percent) { atomic_set(&battery_level_, percent); }
+
+  // Recent hit rate of the channel, 0 (quiet) to kMaxHitRate (every dwell).
+  uint16_t GetHitRate(uint8_t channel) const { return hit_rates_[channel]; }
+  static constexpr uint16_t kMaxHitRate = 256;
+
+ private:
+  uint32_t StretchForBattery(uint32_t ms) const;
+
+  const Options options_;
+  std::array<uint16_t, kMaxChannels> hit_rates_ = {};
+  uint8_t channel_ = 0;
+  bool cycle_had_hits_ = false;
+  uint32_t idle_ms_ = 0;
+  atomic_t battery_level_ = 100;
+};
@@ -1,42 +1,32 @@
 #pragma once
 #include "color.h"
+#include "led_animation.h"
 
-enum class LedChunkType {
-  SetColor,
-  Wait,
-  Finish,
-};
-
-struct LedChunk {
-  LedChunkType type;
-  uint32_t time_ms;
-  Color color;
-};
+// Events signalled to RgbLedSequencer, for kWaitEvent.
+constexpr uint8_t kLedEventBeacon = 1 << 0;
 
-const LedChunk lsqStart[] = {
-    {LedChunkType::SetColor, 0, {255, 0, 0}},
-    {LedChunkType::Wait, 207},
-    {LedChunkType::SetColor, 0, {0, 255, 0}},
-    {LedChunkType::Wait, 207},
-    {LedChunkType::SetColor, 0, {0, 0, 255}},
-    {LedChunkType::Wait, 207},
-    {LedChunkType::SetColor, 0, {0, 0, 0}},
-    {LedChunkType::Finish},
+namespace internal {
+constexpr led_animation::Instruction kStartCode[] = {
+    led_animation::Set({255, 0, 0}),
+    led_animation::Wait(207),
+    led_animation::Set({0, 255, 0}),
+    led_animation::Wait(207),
+    led_animation::Set({0, 0, 255}),
+    led_animation::Wait(207),
+    led_animation::Set({0, 0, 0}),
+    led_animation::End(),
 };
 
-const LedChunk lsqFastBlink[] = {
-    {LedChunkType::SetColor, 0, {255, 255, 255}},
-    {LedChunkType::Wait, 100},
-    {LedChunkType::SetColor, 0, {0, 0, 0}},
-    {LedChunkType::Wait, 100},
-    {LedChunkType::SetColor, 0, {255, 255, 255}},
-    {LedChunkType::Wait, 100},
-    {LedChunkType::SetColor, 0, {0, 0, 0}},
-    {LedChunkType::Wait, 100},
-    {LedChunkType::SetColor, 0, {255, 255, 255}},
-    {LedChunkType::Wait, 100},
-    {LedChunkType::SetColor, 0, {0, 0, 0}},
-    {LedChunkType::Wait, 100},
-    {LedChunkType::Finish},
+constexpr led_animation::Instruction kFastBlinkCode[] = {
+    led_animation::Loop(3),
+    led_animation::Set({255, 255, 255}),
+    led_animation::Wait(100),
+    led_animation::Set({0, 0, 0}),
+    led_animation::Wait(100),
+    led_animation::EndLoop(),
+    led_animation::End(),
 };
+}  // namespace internal
 
+constexpr auto lsqStart = led_animation::Assemble<internal::kStartCode>();
+constexpr auto lsqFastBlink = led_animation::Assemble<internal::kFastBlinkCode>();
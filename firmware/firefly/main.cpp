@@ -1,4 +1,6 @@
 #include <array>
+#include <cstdlib>
+#include <cstring>
 #include <zephyr/device.h>
 #include <zephyr/drivers/gpio.h>
 #include <zephyr/drivers/spi.h>
@@ -18,63 +20,109 @@
 #include "rgb_led.h"
 #include "sequences.h"
 #include "bluetooth.h"
+#include "led_animation.h"
+#include "led_output.h"
+#include "led_strip.h"
 #include "magic_path_packet.h"
+#include "packets_log.h"
+#include "radio_auth.h"
+#include "radio_dispatcher.h"
+#include "radio_relay.h"
+#include "persistent.h"
+#include "power_manager.h"
+#include "scan_scheduler.h"
 
 LOG_MODULE_DECLARE();
 
 
 namespace {
-Buzzer buzzer;
-RgbLed led;
-RgbLedSequencer led_sequencer(led);
-}
+// Activators send a packet every ~37 ms, so listening window of 12.5% of 300 ms
+// is enough to catch one. Full scan of 4 channels takes ~1.35 s.
+const uint32_t kWorPeriodMs = 300;
+const auto kWorRxTime = Cc1101::WorRxTime::k12_5Percent;
+const uint32_t kWorRxWindowMs = kWorPeriodMs / 8;
+// After the first packet on the channel, keep listening for at least that long
+// to hear all other activators on the same channel.
+const uint32_t kBeaconIntervalMs = 40;
 
-struct ColorAndTimestamp {
-  ColorAndTimestamp(): timestamp(0), color(0, 0, 0) {}
-  int32_t timestamp;
-  Color color;
+// Quiet channels get a single WOR period, active ones up to 3 and 3 beacon intervals after
+// the first packet. Quiet air is rescanned after 0.3 s, backing off up to ~5 s (4x at low battery).
+const ScanScheduler::Options kScanOptions = {
+    .num_channels = 4,
+    .min_dwell_ms = kWorPeriodMs + kWorRxWindowMs,
+    .max_dwell_ms = 3 * kWorPeriodMs + kWorRxWindowMs,
+    .min_listen_after_hit_ms = kBeaconIntervalMs,
+    .max_listen_after_hit_ms = 3 * kBeaconIntervalMs,
+    .min_idle_ms = 300,
+    .max_idle_ms = 4800,
 };
+ScanScheduler scan_scheduler(kScanOptions);
 
-class PacketsLog {
-public:
-  void ProcessRadioPacket(const MagicPathRadioPacket& p) {
-    if (p.id >= colors_.size()) {
-      LOG_WRN("Unexpected radio packet with ID = %d", p.id);
-      return;
-    }
+// Below 20% BLE is off, below 10% LED and radio are off too and battery is checked once a minute,
+// below 3% firefly powers off until a button press.
+const PowerManager::Options kPowerOptions = {
+    .idle_below = 20,
+    .deep_sleep_below = 10,
+    .system_off_below = 3,
+    .hysteresis = 5,
+    .check_period_ms = 5000,
+    .deep_sleep_check_period_ms = 60000,
+};
+const gpio_dt_spec kButton1 = GPIO_DT_SPEC_GET(DT_NODELABEL(button_1), gpios);
+const gpio_dt_spec kButton2 = GPIO_DT_SPEC_GET(DT_NODELABEL(button_2), gpios);
 
-    if (p.configure_mode) {
-      background_color_ = p.background_color;
-    }
+Buzzer buzzer;
+#if DT_HAS_ALIAS(led_strip_spi)
+// Installations can have a WS2812 strip instead of the RGB LED (see led_strip.h), lit as a whole.
+const size_t kLedStripPixels = 120;
+LedStrip<kLedStripPixels> led_strip(DEVICE_DT_GET(DT_ALIAS(led_strip_spi)));
+LedOutput& led = led_strip;
+#else
+RgbLed rgb_led;
+LedOutput& led = rgb_led;
+#endif
+RgbLedSequencer led_sequencer(led);
 
-    colors_[p.id].timestamp = k_uptime_get();
-    colors_[p.id].color = p.color;
-  }
+const RadioAuthenticator authenticator(kMagicPathKey);
+// Activators seen within a few seconds, IDs can be anything from 0 to 255.
+const size_t kMaxActivators = 64;
+// Indexed by activator ID.
+RadioReplayGuard<256> replay_guard;
 
-  Color GetColor() const {
-    const auto current_t = k_uptime_get();
-    uint16_t r = 0, g = 0, b = 0;
-    bool see_something = false;
-    for (const auto& entry: colors_) {
-      if (entry.timestamp != 0 && current_t - entry.timestamp < 3000) {
-        r += entry.color.r;
-        g += entry.color.g;
-        b += entry.color.b;
-        see_something = true;
-      }
-    }
+// In relay mode, firefly rebroadcasts beacons it hears, so they reach fireflies out of
+// the activator's range. Relayed beacons are sent after the dwell on the channel is over.
+Persistent<bool> relay_mode(0x00000014);
+atomic_t relay_enabled = 0;
+const RadioRelay<AuthenticatedPayload<MagicPathRadioPacket>>::Options kRelayOptions = {.max_hops = 2,
+                                                                                       .max_jitter_ms = 10};
+// Relays cover more than activators (-30 dBm), as they are few and far between.
+const uint8_t kRelayTxPower = CC_Pwr0dBm;
 
-    if (!see_something) {
-      return background_color_;
-    }
+// LED animation uploaded over BLE, played instead of lsqStart.
+struct LightShow {
+  uint8_t size;
+  std::array<uint8_t, 128> code;
+};
+Persistent<LightShow> light_show(0x00000015, 0x20);
 
-    return Color(std::min<uint16_t>(255, r), std::min<uint16_t>(255, g), std::min<uint16_t>(255, b));
-  }
+// Uploaded show if there is a valid one, lsqStart otherwise.
+std::span<const uint8_t> StartupShow() {
+  // EEPROM contents are checked just like a fresh upload.
+  const auto& show = light_show.value();
+  const std::span<const uint8_t> uploaded_show(show.code.data(), std::min<size_t>(show.size, show.code.size()));
+  return led_animation::Validate(uploaded_show) ? uploaded_show : lsqStart;
+}
 
-private:
-  Color background_color_ = {0, 0, 0};
-  std::array<ColorAndTimestamp, 20> colors_;
-};
+// Must match the activators of the installation, see the same characteristic of the activator.
+Persistent<RfProfile> rf_profile(0x00000016, 0xB0);
+// Applied by the main loop before the next dwell.
+atomic_t rf_profile_value = static_cast<atomic_t>(RfProfile::kDefault);
+
+// Must match the activators of the installation too, see kMagicPathInstallationAddress.
+Persistent<uint8_t> installation_address(0x00000017, 0xC0);
+// Applied by the main loop before the next dwell.
+atomic_t installation_address_value = kMagicPathInstallationAddress;
+}
 
 /* Beep Characteristic, UUID 8ec87062-8865-4eca-82e0-2ea8e45e8221 */
 struct bt_uuid_128 beep_characteristic_uuid = BT_UUID_INIT_128(
@@ -86,6 +134,26 @@ struct bt_uuid_128 blink_characteristic_uuid = BT_UUID_INIT_128(
     0x21, 0x82, 0x5e, 0xe4, 0xa8, 0x2e, 0xe0, 0x82,
     0xca, 0x4e, 0x65, 0x88, 0x63, 0x70, 0xc8, 0x8e);
 
+/* Relay mode Characteristic, UUID 8ec87069-8865-4eca-82e0-2ea8e45e8221 */
+struct bt_uuid_128 relay_mode_characteristic_uuid = BT_UUID_INIT_128(
+    0x21, 0x82, 0x5e, 0xe4, 0xa8, 0x2e, 0xe0, 0x82,
+    0xca, 0x4e, 0x65, 0x88, 0x69, 0x70, 0xc8, 0x8e);
+
+/* Light show Characteristic, UUID 8ec8706a-8865-4eca-82e0-2ea8e45e8221 */
+struct bt_uuid_128 light_show_characteristic_uuid = BT_UUID_INIT_128(
+    0x21, 0x82, 0x5e, 0xe4, 0xa8, 0x2e, 0xe0, 0x82,
+    0xca, 0x4e, 0x65, 0x88, 0x6a, 0x70, 0xc8, 0x8e);
+
+/* RF profile, UUID 8ec87068-8865-4eca-82e0-2ea8e45e8221 */
+struct bt_uuid_128 rf_profile_characteristic_uuid = BT_UUID_INIT_128(
+    0x21, 0x82, 0x5e, 0xe4, 0xa8, 0x2e, 0xe0, 0x82,
+    0xca, 0x4e, 0x65, 0x88, 0x68, 0x70, 0xc8, 0x8e);
+
+/* Installation address, UUID 8ec8706b-8865-4eca-82e0-2ea8e45e8221 */
+struct bt_uuid_128 installation_address_characteristic_uuid = BT_UUID_INIT_128(
+    0x21, 0x82, 0x5e, 0xe4, 0xa8, 0x2e, 0xe0, 0x82,
+    0xca, 0x4e, 0x65, 0x88, 0x6b, 0x70, 0xc8, 0x8e);
+
 ssize_t write_beep(struct bt_conn *conn,
                            const struct bt_gatt_attr *attr,
                            const void *buf, uint16_t len, uint16_t offset,
@@ -101,6 +169,106 @@ ssize_t write_beep(struct bt_conn *conn,
 
 
 
+ssize_t read_relay_mode(struct bt_conn *conn,
+                        const struct bt_gatt_attr *attr,
+                        void *buf, uint16_t len, uint16_t offset) {
+  const uint8_t value = atomic_get(&relay_enabled);
+  return bt_gatt_attr_read(conn, attr, buf, len, offset, &value, sizeof(value));
+}
+
+ssize_t write_relay_mode(struct bt_conn *conn,
+                         const struct bt_gatt_attr *attr,
+                         const void *buf, uint16_t len, uint16_t offset,
+                         uint8_t flags) {
+  if (offset != 0 || len != 1) {
+    return BT_GATT_ERR(BT_ATT_ERR_INVALID_OFFSET);
+  }
+  const bool enabled = *reinterpret_cast<const uint8_t*>(buf) != 0;
+  LOG_INF("Relay mode %s", enabled ? "enabled" : "disabled");
+  atomic_set(&relay_enabled, enabled);
+  relay_mode.value() = enabled;
+  relay_mode.Save();
+  return len;
+}
+
+ssize_t read_rf_profile(struct bt_conn *conn,
+                        const struct bt_gatt_attr *attr,
+                        void *buf, uint16_t len, uint16_t offset) {
+  const uint8_t value = atomic_get(&rf_profile_value);
+  return bt_gatt_attr_read(conn, attr, buf, len, offset, &value, sizeof(value));
+}
+
+ssize_t write_rf_profile(struct bt_conn *conn,
+                         const struct bt_gatt_attr *attr,
+                         const void *buf, uint16_t len, uint16_t offset,
+                         uint8_t flags) {
+  if (offset != 0 || len != sizeof(RfProfile)) {
+    return BT_GATT_ERR(BT_ATT_ERR_INVALID_OFFSET);
+  }
+  const uint8_t value = *reinterpret_cast<const uint8_t*>(buf);
+  if (value >= kRfProfileCount) {
+    return BT_GATT_ERR(BT_ATT_ERR_VALUE_NOT_ALLOWED);
+  }
+  LOG_INF("RF profile %d", value);
+  atomic_set(&rf_profile_value, value);
+  rf_profile.value() = static_cast<RfProfile>(value);
+  rf_profile.Save();
+  return len;
+}
+
+ssize_t read_installation_address(struct bt_conn *conn,
+                                  const struct bt_gatt_attr *attr,
+                                  void *buf, uint16_t len, uint16_t offset) {
+  const uint8_t value = atomic_get(&installation_address_value);
+  return bt_gatt_attr_read(conn, attr, buf, len, offset, &value, sizeof(value));
+}
+
+ssize_t write_installation_address(struct bt_conn *conn,
+                                   const struct bt_gatt_attr *attr,
+                                   const void *buf, uint16_t len, uint16_t offset,
+                                   uint8_t flags) {
+  if (offset != 0 || len != 1) {
+    return BT_GATT_ERR(BT_ATT_ERR_INVALID_OFFSET);
+  }
+  const uint8_t value = *reinterpret_cast<const uint8_t*>(buf);
+  if (!IsValidInstallationAddress(value)) {
+    return BT_GATT_ERR(BT_ATT_ERR_VALUE_NOT_ALLOWED);
+  }
+  LOG_INF("Installation address %d", value);
+  atomic_set(&installation_address_value, value);
+  installation_address.value() = value;
+  installation_address.Save();
+  return len;
+}
+
+ssize_t write_light_show(struct bt_conn *conn,
+                         const struct bt_gatt_attr *attr,
+                         const void *buf, uint16_t len, uint16_t offset,
+                         uint8_t flags) {
+  // Size byte followed by the bytecode, long writes deliver it in parts.
+  auto& show = light_show.value();
+  if (offset + len > sizeof(show)) {
+    return BT_GATT_ERR(BT_ATT_ERR_INVALID_ATTRIBUTE_LEN);
+  }
+  if (flags & BT_GATT_WRITE_FLAG_PREPARE) return 0;
+  // Show is overwritten in place, so it can't be played meanwhile.
+  if (offset == 0) led_sequencer.Stop();
+  memcpy(reinterpret_cast<uint8_t*>(&show) + offset, buf, len);
+  if (offset + len < 1 + show.size) return len;
+
+  const std::span<const uint8_t> code(show.code.data(), show.size);
+  if (offset + len > 1 + show.size || !led_animation::Validate(code)) {
+    LOG_WRN("Invalid light show");
+    show.size = 0;
+    return BT_GATT_ERR(BT_ATT_ERR_VALUE_NOT_ALLOWED);
+  }
+  LOG_INF("New light show, %d bytes", show.size);
+  light_show.Save();
+  led.EnablePowerStabilizer();
+  led_sequencer.StartOrRestart(code);
+  return len;
+}
+
 ssize_t write_blink(struct bt_conn *conn,
                            const struct bt_gatt_attr *attr,
                            const void *buf, uint16_t len, uint16_t offset,
@@ -123,6 +291,26 @@ BT_GATT_SERVICE_DEFINE(firefly_service,
                                               BT_GATT_PERM_WRITE,
                                               nullptr, write_blink, nullptr),
                        BT_GATT_CUD("Blink", BT_GATT_PERM_READ),
+                       BT_GATT_CHARACTERISTIC(&relay_mode_characteristic_uuid.uuid,
+                                              BT_GATT_CHRC_READ | BT_GATT_CHRC_WRITE,
+                                              BT_GATT_PERM_READ | BT_GATT_PERM_WRITE,
+                                              read_relay_mode, write_relay_mode, nullptr),
+                       BT_GATT_CUD("Relay mode", BT_GATT_PERM_READ),
+                       BT_GATT_CHARACTERISTIC(&light_show_characteristic_uuid.uuid,
+                                              BT_GATT_CHRC_WRITE,
+                                              BT_GATT_PERM_WRITE | BT_GATT_PERM_PREPARE_WRITE,
+                                              nullptr, write_light_show, nullptr),
+                       BT_GATT_CUD("Light show", BT_GATT_PERM_READ),
+                       BT_GATT_CHARACTERISTIC(&rf_profile_characteristic_uuid.uuid,
+                                              BT_GATT_CHRC_READ | BT_GATT_CHRC_WRITE,
+                                              BT_GATT_PERM_READ | BT_GATT_PERM_WRITE,
+                                              read_rf_profile, write_rf_profile, nullptr),
+                       BT_GATT_CUD("RF profile", BT_GATT_PERM_READ),
+                       BT_GATT_CHARACTERISTIC(&installation_address_characteristic_uuid.uuid,
+                                              BT_GATT_CHRC_READ | BT_GATT_CHRC_WRITE,
+                                              BT_GATT_PERM_READ | BT_GATT_PERM_WRITE,
+                                              read_installation_address, write_installation_address, nullptr),
+                       BT_GATT_CUD("Installation address", BT_GATT_PERM_READ),
 );
 
 
@@ -133,11 +321,51 @@ int main(void) {
   Cc1101 cc1101;
   cc1101.Init();
   cc1101.SetChannel(1);
+  cc1101.SetTxPower(kRelayTxPower);
+
+  relay_mode.LoadOrInit(false);
+  atomic_set(&relay_enabled, relay_mode.value());
+  light_show.LoadOrInit({});
+  rf_profile.LoadOrInit(RfProfile::kDefault);
+  // EEPROM contents are checked just like a Bluetooth write.
+  if (static_cast<size_t>(rf_profile.value()) >= kRfProfileCount) rf_profile.value() = RfProfile::kDefault;
+  atomic_set(&rf_profile_value, static_cast<atomic_t>(rf_profile.value()));
+  installation_address.LoadOrInit(kMagicPathInstallationAddress);
+  if (!IsValidInstallationAddress(installation_address.value())) {
+    installation_address.value() = kMagicPathInstallationAddress;
+  }
+  atomic_set(&installation_address_value, installation_address.value());
 
   led.EnablePowerStabilizer();
-  PacketsLog log;
+  PacketsLog<kMaxActivators> log;
 
-  atomic_t low_power_mode = 0;
+  RadioRelay<AuthenticatedPayload<MagicPathRadioPacket>> relay(cc1101, kRelayOptions);
+  RadioPacketDispatcher dispatcher;
+  dispatcher.Register<RelayedPayload<AuthenticatedPayload<MagicPathRadioPacket>>>(
+      kMagicPathAuthenticatedBeaconType,
+      [&log, &relay](const RelayedPayload<AuthenticatedPayload<MagicPathRadioPacket>>& relayed,
+                     const RadioPacketInfo& info) {
+        const auto& authenticated = relayed.payload;
+        const auto& p = authenticated.payload;
+        const RadioPacketHeader header = {.address = info.address, .type = kMagicPathAuthenticatedBeaconType};
+        if (!authenticator.Verify(header, authenticated)) {
+          LOG_WRN("Dropping packet with bad MIC, ID=%d", p.id);
+          return;
+        }
+        if (!replay_guard.Accept(p.id, authenticated.counter)) {
+          LOG_DBG("Dropping replayed packet, ID=%d, counter=%u, hops=%d", p.id, authenticated.counter, relayed.hops);
+          return;
+        }
+        // Only fresh beacons: hops aren't covered by the MIC, so an old beacon replayed with
+        // hops = 0 would be rebroadcast once it's out of the relay's recent packets cache.
+        if (atomic_get(&relay_enabled)) {
+          relay.Enqueue(header, relayed, RecentPacketKey(p.id, authenticated.counter));
+        }
+        LOG_DBG("Got packet! ID=%d, R=%d, G=%d, B=%d, RSSI=%d, LQI=%d, hops=%d", p.id, p.color.r, p.color.g,
+                p.color.b, info.rssi_dbm, info.lqi, relayed.hops);
+        log.ProcessRadioPacket({.packet = p, .rssi_dbm = info.rssi_dbm, .lqi = info.lqi, .crc_ok = true});
+        led_sequencer.Signal(kLedEventBeacon);
+      });
 
   auto t1 = RunEvery([&log](){
     auto c = log.GetColor();
@@ -145,35 +373,80 @@ int main(void) {
     led.SetColorSmooth(c, 1000);
   }, 1000);
 
-  auto t2 = RunEvery([&cc1101, &low_power_mode, &t1](){
+  PowerManager power_manager(kPowerOptions, [&cc1101]() -> uint8_t {
     auto v = Battery::GetInstance().GetVoltage();
-    if (v == 0) return; // Workaround for the first measurement
+    if (v == 0) return PowerManager::kUnknownBatteryLevel; // Workaround for the first measurement
     LOG_INF("Adc result: %d", v);
+    // Frequency synthesizer calibration depends on the supply voltage.
+    static int32_t calibration_voltage = v;
+    if (std::abs(v - calibration_voltage) > 100) {
+      calibration_voltage = v;
+      cc1101.InvalidateCalibration();
+    }
     const uint8_t level = std::clamp(v / 3 - 790, 0, 100);
     SetBatteryLevel(level);
-    if (level < 10) {
-      LOG_WRN("Entering low power mode");
-      atomic_set(&low_power_mode, 1);
-      t1.Cancel();
-      led.SetColor({0, 0, 0});
-      led.DisablePowerStabilizer();
-      cc1101.EnterPwrDown();
-    }
-  }, 5000);
+    scan_scheduler.SetBatteryLevel(level);
+    return level;
+  });
+  // Nobody is going to configure a firefly with a low battery.
+  power_manager.RegisterHooks(PowerState::kIdle, StopBleAdvertising, ResumeBleAdvertising);
+  power_manager.RegisterHooks(
+      PowerState::kDeepSleep,
+      [&t1]() {
+        t1.Cancel();
+        // Otherwise the show keeps waking the CPU and lights the LED again.
+        led_sequencer.Stop();
+        led.SetColor({0, 0, 0});
+        led.DisablePowerStabilizer();
+      },
+      [&t1]() {
+        led.EnablePowerStabilizer();
+        t1.RunEvery(1000);
+        led_sequencer.StartOrRestart(StartupShow());
+      });
+  // Radio wakes up by itself on the next access.
+  power_manager.RegisterHooks(PowerState::kDeepSleep, [&cc1101]() { cc1101.Sleep(); }, nullptr);
+  power_manager.AddWakeButton(kButton1);
+  power_manager.AddWakeButton(kButton2);
+  power_manager.Start();
 
-  led_sequencer.StartOrRestart(lsqStart);
+  led_sequencer.StartOrRestart(StartupShow());
 
   while (true) {
-    MagicPathRadioPacket pkt;
-    if (atomic_get(&low_power_mode)) k_sleep(K_FOREVER);
-
-    for (int ch = 0; ch < 4; ++ch) {
-      cc1101.SetChannel(ch);
-      if (cc1101.Receive(63, &pkt)) {
-        LOG_DBG("Got packet! ID=%d, R=%d, G=%d, B=%d", pkt.id, pkt.color.r, pkt.color.g, pkt.color.b);
-        log.ProcessRadioPacket(pkt);
+    power_manager.ApplyPendingTransition();
+    if (power_manager.GetState() >= PowerState::kDeepSleep) {
+      power_manager.AwaitTransition(K_FOREVER);
+      continue;
+    }
+
+    const auto dwell = scan_scheduler.NextDwell();
+    if (dwell.idle_before_ms != 0) {
+      LOG_DBG("Air is quiet, sleeping for %u ms", dwell.idle_before_ms);
+      cc1101.Sleep();
+      k_sleep(K_MSEC(dwell.idle_before_ms));
+    }
+
+    // No-op unless profile was changed via Bluetooth.
+    cc1101.SetRfProfile(static_cast<RfProfile>(atomic_get(&rf_profile_value)));
+    cc1101.SetAddressFilter(atomic_get(&installation_address_value), Cc1101::AddressCheck::kExactOrBothBroadcasts);
+    cc1101.SetChannel(dwell.channel);
+    // Radio duty-cycles RX by itself, MCU sleeps until a packet arrives
+    // or it's time to switch to the next channel.
+    cc1101.StartWakeOnRadio(dispatcher.GetMaxPacketSize(), kWorPeriodMs, kWorRxTime);
+    int64_t dwell_end = k_uptime_get() + dwell.duration_ms;
+    bool heard_something = false;
+    for (int64_t now = k_uptime_get(); now < dwell_end; now = k_uptime_get()) {
+      if (dispatcher.AwaitAndDispatch(cc1101, dwell_end - now)) {
+        if (!heard_something) {
+          // Radio is in continuous RX now, drain everyone sending on this channel.
+          heard_something = true;
+          dwell_end = k_uptime_get() + dwell.listen_after_hit_ms;
+        }
       }
     }
-    k_sleep(K_MSEC(810));
+    cc1101.StopReceive();
+    scan_scheduler.ReportDwell(heard_something);
+    // Jittered, and only sent if the channel is clear, so relays which heard the same beacon don't collide.
+    relay.Flush();
   }
 }
@@ -0,0 +1,137 @@
+#include <algorithm>
+#include <array>
+#include <chrono>
+#include <cstdio>
+#include <random>
+
+#include "color.h"
+#include "gtest/gtest.h"
+
+namespace {
+TEST(DecayingColorMixerTest, MixesColors) {
+  DecayingColorMixer additive(ColorMixMode::kAdditive, 0);
+  DecayingColorMixer average(ColorMixMode::kAverage, 0);
+  for (auto* mixer : {&additive, &average}) {
+    mixer->Add({200, 0, 100}, kWeightOne, 0);
+    mixer->Add({100, 100, 0}, kWeightOne, 0);
+    mixer->Add({0, 0, 100}, kWeightOne / 2, 0);
+  }
+  EXPECT_EQ(additive.Get(0), Color(255, 100, 150));
+  EXPECT_EQ(average.Get(0), Color(120, 40, 60));
+}
+
+TEST(DecayingColorMixerTest, SingleWeakSourceStaysDimOnAverage) {
+  DecayingColorMixer average(ColorMixMode::kAverage, 0);
+  average.Add({200, 100, 0}, kWeightOne / 2, 0);
+  EXPECT_EQ(average.Get(0), Color(100, 50, 0));
+}
+
+TEST(DecayingColorMixerTest, RemovesSources) {
+  DecayingColorMixer mixer(ColorMixMode::kAdditive, 0);
+  mixer.Add({100, 0, 0}, kWeightOne, 0);
+  const ColorContribution c = mixer.Add({0, 100, 0}, kWeightOne, 0);
+  mixer.Remove(c);
+  EXPECT_EQ(mixer.Get(0), Color(100, 0, 0));
+}
+
+TEST(DecayingColorMixerTest, DecaysByHalfEveryHalfLife) {
+  DecayingColorMixer mixer(ColorMixMode::kAdditive, 500);
+  mixer.Reset(1000);
+  mixer.Add({200, 100, 40}, kWeightOne, 1000);
+  EXPECT_EQ(mixer.Get(1000), Color(200, 100, 40));
+  EXPECT_EQ(mixer.Get(1500), Color(100, 50, 20));
+  EXPECT_EQ(mixer.Get(2000), Color(50, 25, 10));
+  // Newer source isn't decayed yet.
+  mixer.Add({0, 0, 100}, kWeightOne, 2000);
+  EXPECT_EQ(mixer.Get(2000), Color(50, 25, 110));
+}
+
+TEST(DecayingColorMixerTest, RebaseKeepsTheMix) {
+  const uint32_t kHalfLifeMs = 100;
+  DecayingColorMixer mixer(ColorMixMode::kAverage, kHalfLifeMs);
+  std::array<ColorContribution, 2> contributions = {
+      mixer.Add({200, 0, 0}, kWeightOne, 0),
+      mixer.Add({0, 200, 0}, kWeightOne / 2, 300),
+  };
+  const int64_t now = DecayingColorMixer::kRebaseHalfLives * kHalfLifeMs;
+  ASSERT_TRUE(mixer.NeedsRebase(now));
+  const Color before = mixer.Get(now);
+  mixer.Rebase(now, [&](const auto& rescale) {
+    for (auto& c : contributions) rescale(c);
+  });
+  EXPECT_FALSE(mixer.NeedsRebase(now));
+  const Color after = mixer.Get(now);
+  EXPECT_NEAR(after.r, before.r, 1);
+  EXPECT_NEAR(after.g, before.g, 1);
+  // Contributions are rescaled, so they still can be removed.
+  mixer.Remove(contributions[1]);
+  EXPECT_EQ(mixer.Get(now).g, 0);
+}
+
+TEST(MaxColorMixerTest, MixesColors) {
+  MaxColorMixer max;
+  max.Add({200, 0, 100}, kWeightOne);
+  max.Add({100, 100, 0}, kWeightOne);
+  max.Add({0, 0, 100}, kWeightOne / 2);
+  EXPECT_EQ(max.Get(), Color(200, 100, 100));
+}
+
+// Compares mixing of 64 activators with the loop PacketsLog::GetColor used to run over all
+// its entries, on every call. Numbers are for the host CPU, see PacketsLogTest.Benchmark in
+// smoke_test for the device.
+TEST(DecayingColorMixerTest, Benchmark) {
+  constexpr size_t kSources = 64;
+  constexpr int kIterations = 100000;
+  std::mt19937 random(42);
+  std::array<Color, kSources> colors;
+  std::array<uint8_t, kSources> weights;
+  for (size_t i = 0; i < kSources; ++i) {
+    colors[i] = Color(random(), random(), random());
+    weights[i] = 32 + random() % 224;
+  }
+
+  using Clock = std::chrono::steady_clock;
+  auto start = Clock::now();
+  Color plain;
+  for (int iteration = 0; iteration < kIterations; ++iteration) {
+    uint16_t r = 0, g = 0, b = 0;
+    for (size_t i = 0; i < kSources; ++i) {
+      r += colors[i].r * weights[i] / 255;
+      g += colors[i].g * weights[i] / 255;
+      b += colors[i].b * weights[i] / 255;
+    }
+    plain = Color(std::min<uint16_t>(255, r), std::min<uint16_t>(255, g), std::min<uint16_t>(255, b));
+    // Keeps the compiler from hoisting the loop out.
+    asm volatile("" : : "r"(&plain) : "memory");
+  }
+  const auto plain_ns = std::chrono::duration_cast<std::chrono::nanoseconds>(Clock::now() - start).count();
+
+  DecayingColorMixer additive(ColorMixMode::kAdditive, 0);
+  DecayingColorMixer average(ColorMixMode::kAverage, 750);
+  for (size_t i = 0; i < kSources; ++i) {
+    const WeightQ8 weight = weights[i] + (weights[i] >> 7);
+    additive.Add(colors[i], weight, 0);
+    average.Add(colors[i], weight, 0);
+  }
+  start = Clock::now();
+  Color mixed;
+  for (int iteration = 0; iteration < kIterations; ++iteration) {
+    mixed = additive.Get(iteration % 1000);
+    asm volatile("" : : "r"(&mixed) : "memory");
+  }
+  const auto additive_ns = std::chrono::duration_cast<std::chrono::nanoseconds>(Clock::now() - start).count();
+
+  start = Clock::now();
+  for (int iteration = 0; iteration < kIterations; ++iteration) {
+    Color c = average.Get(iteration % 1000);
+    asm volatile("" : : "r"(&c) : "memory");
+  }
+  const auto average_ns = std::chrono::duration_cast<std::chrono::nanoseconds>(Clock::now() - start).count();
+
+  std::printf("Mixing %zu colors: plain loop %lld ns, DecayingColorMixer::Get %lld (additive) / %lld (average) ns\n",
+              kSources, static_cast<long long>(plain_ns / kIterations),
+              static_cast<long long>(additive_ns / kIterations), static_cast<long long>(average_ns / kIterations));
+  // That many random colors saturate either way.
+  EXPECT_EQ(mixed, plain);
+}
+}  // namespace
@@ -0,0 +1,77 @@
+#include <openssl/evp.h>
+
+#include <cstring>
+
+#include "gtest/gtest.h"
+#include "radio_mic.h"
+
+namespace {
+// Same as bt_encrypt_be on the device: AES-128 ECB of a single block.
+bool EncryptWithOpenSsl(const RadioAuthKey& key, const uint8_t plaintext[kAesBlockSize],
+                        uint8_t ciphertext[kAesBlockSize]) {
+  EVP_CIPHER_CTX* ctx = EVP_CIPHER_CTX_new();
+  int size = 0;
+  const bool ok = ctx && EVP_EncryptInit_ex(ctx, EVP_aes_128_ecb(), nullptr, key.data(), nullptr) &&
+                  EVP_CIPHER_CTX_set_padding(ctx, 0) &&
+                  EVP_EncryptUpdate(ctx, ciphertext, &size, plaintext, kAesBlockSize) && size == kAesBlockSize;
+  EVP_CIPHER_CTX_free(ctx);
+  return ok;
+}
+
+bool FailingEncrypt(const RadioAuthKey&, const uint8_t[kAesBlockSize], uint8_t[kAesBlockSize]) {
+  return false;
+}
+
+// Expected MICs are computed with `openssl enc -aes-128-cbc -nopad` and zero IV, the same vectors
+// are checked on the device with the hardware AES (RadioAuthenticatorTest in smoke_test).
+const RadioAuthKey kTestKey = {0x00, 0x01, 0x02, 0x03, 0x04, 0x05, 0x06, 0x07,
+                               0x08, 0x09, 0x0a, 0x0b, 0x0c, 0x0d, 0x0e, 0x0f};
+// RadioPacketHeader with address 1 and type 2.
+const uint8_t kHeader[] = {0x01, 0x02};
+
+TEST(RadioMicTest, ComputesSingleBlockMic) {
+  const uint8_t payload[] = {0xaa, 0xbb};
+  uint8_t mic[kRadioMicSize];
+  ASSERT_TRUE(ComputeRadioMic(EncryptWithOpenSsl, kTestKey, kHeader, sizeof(kHeader), payload, sizeof(payload),
+                              0x01020304, mic));
+  const uint8_t expected[kRadioMicSize] = {0x26, 0x5f, 0xaa, 0x43};
+  EXPECT_EQ(memcmp(mic, expected, kRadioMicSize), 0);
+}
+
+TEST(RadioMicTest, ComputesMultiBlockMic) {
+  const uint8_t payload[] = {0, 1, 2, 3, 4, 5, 6, 7, 8, 9};
+  uint8_t mic[kRadioMicSize];
+  ASSERT_TRUE(ComputeRadioMic(EncryptWithOpenSsl, kTestKey, kHeader, sizeof(kHeader), payload, sizeof(payload),
+                              0x01020304, mic));
+  const uint8_t expected[kRadioMicSize] = {0x00, 0x1f, 0x8f, 0x98};
+  EXPECT_EQ(memcmp(mic, expected, kRadioMicSize), 0);
+}
+
+TEST(RadioMicTest, DependsOnEveryField) {
+  const uint8_t payload[] = {0xaa, 0xbb};
+  uint8_t mic[kRadioMicSize];
+  ASSERT_TRUE(ComputeRadioMic(EncryptWithOpenSsl, kTestKey, kHeader, sizeof(kHeader), payload, sizeof(payload),
+                              0x01020304, mic));
+
+  uint8_t other[kRadioMicSize];
+  const uint8_t other_header[] = {0x03, 0x02};
+  ASSERT_TRUE(ComputeRadioMic(EncryptWithOpenSsl, kTestKey, other_header, sizeof(other_header), payload,
+                              sizeof(payload), 0x01020304, other));
+  EXPECT_NE(memcmp(mic, other, kRadioMicSize), 0);
+  ASSERT_TRUE(ComputeRadioMic(EncryptWithOpenSsl, kTestKey, kHeader, sizeof(kHeader), payload, 1, 0x01020304, other));
+  EXPECT_NE(memcmp(mic, other, kRadioMicSize), 0);
+  ASSERT_TRUE(ComputeRadioMic(EncryptWithOpenSsl, kTestKey, kHeader, sizeof(kHeader), payload, sizeof(payload),
+                              0x01020305, other));
+  EXPECT_NE(memcmp(mic, other, kRadioMicSize), 0);
+}
+
+TEST(RadioMicTest, RejectsOversizedPayloadAndEncryptionFailure) {
+  const uint8_t payload[kMaxRadioMicPayloadSize + 1] = {};
+  uint8_t mic[kRadioMicSize];
+  EXPECT_FALSE(ComputeRadioMic(EncryptWithOpenSsl, kTestKey, kHeader, sizeof(kHeader), payload, sizeof(payload), 0,
+                               mic));
+  EXPECT_TRUE(ComputeRadioMic(EncryptWithOpenSsl, kTestKey, kHeader, sizeof(kHeader), payload,
+                              kMaxRadioMicPayloadSize, 0, mic));
+  EXPECT_FALSE(ComputeRadioMic(FailingEncrypt, kTestKey, kHeader, sizeof(kHeader), payload, 1, 0, mic));
+}
+}  // namespace
@@ -20,6 +20,7 @@
 #include "rgb_led.h"
 #include "test.pwpb.h"
 #include "test.rpc.pwpb.h"
+#include "timer.h"
 
 using namespace common::rpc;
 using namespace std::chrono_literals;
@@ -53,10 +54,12 @@ TEST(RgbLedTest, SmoothColorTransition) {
   led.SetColor({0, 0, 0});
   led.SetColorSmooth({254, 0, 0}, 1000);
   ASSERT_EQ(led.GetColor(), Color(0, 0, 0));
-  pw::this_thread::sleep_for(SystemClock::for_at_least(550ms));
+  pw::this_thread::sleep_for(SystemClock::for_at_least(500ms));
+  // Half of the light, which is perceived brighter than the half of 254.
+  const int half = FromLinear(uint16_t(ToLinear(254) / 2));
   auto r = led.GetColor().r;
-  ASSERT_GE(r, 127 - 10);
-  ASSERT_LE(r, 127 + 10);
+  ASSERT_GE(r, half - 10);
+  ASSERT_LE(r, half + 10);
   pw::this_thread::sleep_for(SystemClock::for_at_least(550ms));
   ASSERT_EQ(led.GetColor().r, 254);
 }
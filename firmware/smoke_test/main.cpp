@@ -1,29 +1,56 @@
 #include <zephyr/kernel.h>
 #include <zephyr/random/random.h>
 
+#include <algorithm>
 #include <array>
 #include <atomic>
 #include <functional>
 #include <memory>
+#include <variant>
 
 #include "buzzer.h"
 #include "cc1101.h"
 #include "eeprom.h"
+#include "frame_scheduler.h"
+#include "packets_log.h"
 #include "gtest/gtest.h"
 #include "printk_event_handler.h"
+#include "radio_auth.h"
+#include "radio_dispatcher.h"
+#include "power_manager.h"
+#include "radio_relay.h"
 #include "rgb_led.h"
+#include "led_strip.h"
+#include "scan_scheduler.h"
 #include "timer.h"
 
 Buzzer buzzer;
 Cc1101 cc1101;
 
-TEST(Cc1101Test, CanInit) { cc1101.Init(); }
+TEST(Cc1101Test, CanInit) {
+  const uint32_t start = k_cycle_get_32();
+  cc1101.Init();
+  const uint32_t elapsed_us = k_cyc_to_us_floor32(k_cycle_get_32() - start);
+  printk("Cc1101::Init took %u us\n", elapsed_us);
+  // Used to be > 40 ms because of the fixed post-reset sleep.
+  ASSERT_LT(elapsed_us, 10000u);
+}
 
 TEST(Cc1101Test, CanSetPacketSize) {
   cc1101.SetPacketSize(12);
   ASSERT_EQ(cc1101.GetPacketSize(), 12);
 }
 
+TEST(Cc1101Test, SkipsRedundantRegisterWrites) {
+  cc1101.SetPacketSize(13);
+  const auto writes = cc1101.GetRegisterWrites();
+  const auto suppressed = cc1101.GetSuppressedRegisterWrites();
+  cc1101.SetPacketSize(13);
+  ASSERT_EQ(cc1101.GetRegisterWrites(), writes);
+  ASSERT_EQ(cc1101.GetSuppressedRegisterWrites(), suppressed + 1);
+  ASSERT_EQ(cc1101.GetPacketSize(), 13);
+}
+
 TEST(Cc1101Test, CanTransmitSomething) {
   struct Data {
     uint8_t a, b;
@@ -33,6 +60,384 @@ TEST(Cc1101Test, CanTransmitSomething) {
   cc1101.Transmit(d);
 }
 
+TEST(Cc1101Test, WakesUpFromSleep) {
+  struct Data {
+    uint8_t a, b;
+  };
+  Data d = {.a = 5, .b = 10};
+
+  cc1101.SetPacketSize(14);
+  cc1101.Sleep();
+  ASSERT_TRUE(cc1101.IsAsleep());
+  // Configuration registers survive SLEEP.
+  ASSERT_EQ(cc1101.GetPacketSize(), 14);
+  ASSERT_FALSE(cc1101.IsAsleep());
+  cc1101.Transmit(d);
+}
+
+TEST(Cc1101Test, CanSwitchRfProfile) {
+  struct Data {
+    uint8_t a, b;
+  };
+  Data d = {.a = 5, .b = 10};
+
+  cc1101.SetRfProfile(RfProfile::kShortAirtime);
+  ASSERT_EQ(cc1101.GetRfProfile(), RfProfile::kShortAirtime);
+  cc1101.Transmit(d);
+  cc1101.SetRfProfile(RfProfile::kDefault);
+  ASSERT_EQ(cc1101.GetRfProfile(), RfProfile::kDefault);
+}
+
+TEST(Cc1101Test, TransmitsIfChannelIsClear) {
+  struct Data {
+    uint8_t a, b;
+  };
+  Data d = {.a = 5, .b = 10};
+
+  // Nobody else is transmitting during the test.
+  ASSERT_TRUE(cc1101.TransmitIfChannelClear(d));
+}
+
+TEST(Cc1101Test, QueuedTransmitSendsAllPackets) {
+  struct Data {
+    uint8_t a, b;
+  };
+  std::atomic<uint8_t> sent = 0;
+  cc1101.SetTransmitCallback([&](bool ok) {
+    if (ok) ++sent;
+  });
+
+  for (uint8_t i = 0; i < 3; ++i) {
+    ASSERT_TRUE(cc1101.QueueTransmit(Data{.a = i, .b = 10}));
+  }
+  k_sleep(K_MSEC(50));
+  cc1101.SetTransmitCallback(nullptr);
+  // Nobody else is transmitting during the test.
+  ASSERT_EQ(sent, 3);
+}
+
+TEST(Cc1101Test, TransmitsVariableLengthPackets) {
+  struct Short {
+    uint8_t a;
+  };
+  struct Long {
+    uint8_t a, b, c, d;
+  };
+
+  Short s = {.a = 1};
+  Long l = {.a = 1, .b = 2, .c = 3, .d = 4};
+
+  cc1101.SetPacketLength(Cc1101::PacketLength::kVariable);
+  ASSERT_EQ(cc1101.GetPacketLength(), Cc1101::PacketLength::kVariable);
+  cc1101.Transmit(s);
+  cc1101.Transmit(l);
+  cc1101.SetPacketLength(Cc1101::PacketLength::kFixed);
+}
+
+TEST(Cc1101Test, AsyncReceiveTimesOutWithoutTraffic) {
+  struct Data {
+    uint8_t a, b;
+  };
+  Data d;
+
+  cc1101.StartReceive<Data>();
+  ASSERT_FALSE(cc1101.AwaitPacket(20, &d));
+  cc1101.StopReceive();
+}
+
+TEST(RadioPacketDispatcherTest, DispatchesByType) {
+  struct Data {
+    uint8_t a, b;
+  };
+  RadioPacketDispatcher dispatcher;
+  uint8_t received_a = 0;
+  ASSERT_TRUE(dispatcher.Register<Data>(7, [&](const Data& d, const RadioPacketInfo& info) { received_a = d.a; }));
+  ASSERT_FALSE(dispatcher.Register<Data>(7, [](const Data& d, const RadioPacketInfo& info) {}));
+  ASSERT_EQ(dispatcher.GetMaxPacketSize(), sizeof(TypedRadioPacket<Data>));
+
+  Cc1101::RawReceivedPacket packet = {.size = 4, .data = {1, 7, 42, 0}, .rssi_dbm = -50, .lqi = 0, .crc_ok = true};
+  ASSERT_TRUE(dispatcher.Dispatch(packet));
+  ASSERT_EQ(received_a, 42);
+
+  packet.data[1] = 8;
+  ASSERT_FALSE(dispatcher.Dispatch(packet));
+  packet.data[1] = 7;
+  packet.size = 3;
+  ASSERT_FALSE(dispatcher.Dispatch(packet));
+}
+
+// Local classes can't have static members, such as kRadioPacketType.
+struct ShortTestPayload {
+  static constexpr uint8_t kRadioPacketType = 10;
+  uint8_t a;
+};
+struct LongTestPayload {
+  static constexpr uint8_t kRadioPacketType = 11;
+  uint8_t a, b, c, d;
+};
+
+TEST(RadioPacketDispatcherTest, ReceivesAnyOfSeveralPacketTypes) {
+  using Short = ShortTestPayload;
+  using Long = LongTestPayload;
+  using AnyPayload = std::variant<Short, Long>;
+  const TypedRadioPacket<Short> s = {.header = {.address = 1, .type = Short::kRadioPacketType}, .payload = {.a = 5}};
+  const TypedRadioPacket<Long> l = {.header = {.address = 1, .type = Long::kRadioPacketType},
+                                    .payload = {.a = 1, .b = 2, .c = 3, .d = 4}};
+
+  cc1101.SetPacketLength(Cc1101::PacketLength::kVariable);
+  cc1101.Transmit(s);
+  cc1101.Transmit(l);
+
+  // There is a single radio on the board, so packets are received as the driver would queue them:
+  // the length byte stripped, just the bytes which were sent.
+  const auto received = [](const auto& sent) {
+    Cc1101::RawReceivedPacket packet = {.size = sizeof(sent), .data = {}, .rssi_dbm = -50, .lqi = 0, .crc_ok = true};
+    memcpy(packet.data, &sent, sizeof(sent));
+    return packet;
+  };
+  AnyPayload payload;
+  RadioPacketInfo info;
+  ASSERT_TRUE(ParseAnyPacket(received(l), &payload, &info));
+  ASSERT_TRUE(std::holds_alternative<Long>(payload));
+  ASSERT_EQ(std::get<Long>(payload).d, 4);
+  ASSERT_EQ(info.address, 1);
+  ASSERT_TRUE(ParseAnyPacket(received(s), &payload));
+  ASSERT_TRUE(std::holds_alternative<Short>(payload));
+  ASSERT_EQ(std::get<Short>(payload).a, 5);
+
+  // Type and size must match.
+  auto mismatched = received(l);
+  mismatched.data[1] = Short::kRadioPacketType;
+  ASSERT_FALSE(ParseAnyPacket(mismatched, &payload));
+  auto bad_crc = received(s);
+  bad_crc.crc_ok = false;
+  ASSERT_FALSE(ParseAnyPacket(bad_crc, &payload));
+
+  // One session for both types. Nobody else is transmitting during the test.
+  cc1101.StartReceive<TypedRadioPacket<Long>>();
+  ASSERT_FALSE(AwaitAnyPacket(cc1101, 20, &payload));
+  cc1101.StopReceive();
+  cc1101.SetPacketLength(Cc1101::PacketLength::kFixed);
+}
+
+// Expected MICs are computed with `openssl enc -aes-128-cbc -nopad` and zero IV. Host tests check the
+// same vectors (host_test/radio_mic_test.cpp), these check the hardware AES.
+const RadioAuthKey kTestKey = {0x00, 0x01, 0x02, 0x03, 0x04, 0x05, 0x06, 0x07,
+                               0x08, 0x09, 0x0a, 0x0b, 0x0c, 0x0d, 0x0e, 0x0f};
+
+TEST(RadioAuthenticatorTest, ComputesSingleBlockMic) {
+  const RadioAuthenticator authenticator(kTestKey);
+  const uint8_t payload[] = {0xaa, 0xbb};
+  uint8_t mic[kRadioMicSize];
+  ASSERT_TRUE(authenticator.ComputeMic({.address = 1, .type = 2}, payload, sizeof(payload), 0x01020304, mic));
+  const uint8_t expected[kRadioMicSize] = {0x26, 0x5f, 0xaa, 0x43};
+  ASSERT_EQ(memcmp(mic, expected, kRadioMicSize), 0);
+}
+
+TEST(RadioAuthenticatorTest, ComputesMultiBlockMic) {
+  const RadioAuthenticator authenticator(kTestKey);
+  const uint8_t payload[] = {0, 1, 2, 3, 4, 5, 6, 7, 8, 9};
+  uint8_t mic[kRadioMicSize];
+  ASSERT_TRUE(authenticator.ComputeMic({.address = 1, .type = 2}, payload, sizeof(payload), 0x01020304, mic));
+  const uint8_t expected[kRadioMicSize] = {0x00, 0x1f, 0x8f, 0x98};
+  ASSERT_EQ(memcmp(mic, expected, kRadioMicSize), 0);
+}
+
+TEST(RadioAuthenticatorTest, RejectsModifiedPackets) {
+  struct Data {
+    uint8_t a, b;
+  };
+  const RadioAuthenticator authenticator(kTestKey);
+  TypedRadioPacket<AuthenticatedPayload<Data>> p;
+  p.header = {.address = 1, .type = 2};
+  p.payload.payload = {.a = 5, .b = 10};
+  ASSERT_TRUE(authenticator.Sign(p.header, &p.payload, 42));
+  ASSERT_TRUE(authenticator.Verify(p.header, p.payload));
+
+  p.payload.counter = 43;
+  ASSERT_FALSE(authenticator.Verify(p.header, p.payload));
+  p.payload.counter = 42;
+  p.header.address = 3;
+  ASSERT_FALSE(authenticator.Verify(p.header, p.payload));
+}
+
+TEST(RadioReplayGuardTest, AcceptsOnlyGrowingCounters) {
+  RadioReplayGuard<2> guard;
+  ASSERT_TRUE(guard.Accept(0, 10));
+  ASSERT_FALSE(guard.Accept(0, 10));
+  ASSERT_FALSE(guard.Accept(0, 9));
+  ASSERT_TRUE(guard.Accept(1, 5));
+  ASSERT_TRUE(guard.Accept(0, 11));
+  ASSERT_FALSE(guard.Accept(2, 100));
+}
+
+TEST(RecentPacketCacheTest, SuppressesDuplicates) {
+  RecentPacketCache cache;
+  ASSERT_TRUE(cache.Insert(RecentPacketKey(1, 100)));
+  ASSERT_FALSE(cache.Insert(RecentPacketKey(1, 100)));
+  ASSERT_TRUE(cache.Insert(RecentPacketKey(2, 100)));
+  ASSERT_TRUE(cache.Insert(RecentPacketKey(1, 101)));
+
+  // Oldest keys are evicted.
+  for (uint32_t i = 0; i < RecentPacketCache::kCapacity; ++i) {
+    ASSERT_TRUE(cache.Insert(RecentPacketKey(3, i)));
+  }
+  ASSERT_TRUE(cache.Insert(RecentPacketKey(1, 100)));
+}
+
+TEST(MaxColorMixerTest, MixesColors) {
+  MaxColorMixer max;
+  max.Add({200, 0, 100}, kWeightOne);
+  max.Add({100, 100, 0}, kWeightOne);
+  max.Add({0, 0, 100}, kWeightOne / 2);
+  ASSERT_EQ(max.Get(), Color(200, 100, 100));
+}
+
+TEST(PacketsLogTest, Benchmark) {
+  constexpr size_t kActivators = 64;
+  std::array<Color, kActivators> colors;
+  std::array<uint8_t, kActivators> weights;
+  for (size_t i = 0; i < colors.size(); ++i) {
+    colors[i] = Color(sys_rand32_get(), sys_rand32_get(), sys_rand32_get());
+    weights[i] = 32 + sys_rand32_get() % 224;
+  }
+  // Static, they don't fit the stack.
+  static PacketsLog<kActivators> additive(ColorMixMode::kAdditive, 0);
+  // What firefly runs.
+  static PacketsLog<kActivators> average;
+  const int64_t now = k_uptime_get();
+  for (size_t i = 0; i < colors.size(); ++i) {
+    const WeightQ8 weight = weights[i] + (weights[i] >> 7);
+    ASSERT_TRUE(additive.Update(i, colors[i], weight, now));
+    ASSERT_TRUE(average.Update(i, colors[i], weight, now));
+  }
+
+  // The loop PacketsLog::GetColor used to run.
+  uint32_t start = k_cycle_get_32();
+  uint16_t r = 0, g = 0, b = 0;
+  for (size_t i = 0; i < colors.size(); ++i) {
+    r += colors[i].r * weights[i] / 255;
+    g += colors[i].g * weights[i] / 255;
+    b += colors[i].b * weights[i] / 255;
+  }
+  const Color plain(std::min<uint16_t>(255, r), std::min<uint16_t>(255, g), std::min<uint16_t>(255, b));
+  const uint32_t plain_cycles = k_cycle_get_32() - start;
+
+  start = k_cycle_get_32();
+  const Color mixed = additive.GetColor(now);
+  const uint32_t additive_cycles = k_cycle_get_32() - start;
+
+  start = k_cycle_get_32();
+  average.GetColor(now);
+  const uint32_t average_cycles = k_cycle_get_32() - start;
+
+  printk("Mixing %zu colors: plain loop %u cycles, PacketsLog::GetColor %u (additive) / %u (average) cycles\n",
+         colors.size(), plain_cycles, additive_cycles, average_cycles);
+  // That many random colors saturate either way.
+  ASSERT_EQ(mixed, plain);
+}
+
+TEST(PacketsLogTest, DecaysColors) {
+  PacketsLog<2> log(ColorMixMode::kAverage, 1000);
+  ASSERT_TRUE(log.Update(1, {200, 0, 0}, kWeightOne, 0));
+  ASSERT_EQ(log.GetColor(0), Color(200, 0, 0));
+  ASSERT_EQ(log.GetColor(1000), Color(100, 0, 0));
+  // Fresh strong source dominates the decayed one.
+  ASSERT_TRUE(log.Update(2, {0, 200, 0}, kWeightOne, 1000));
+  const Color c = log.GetColor(1000);
+  ASSERT_EQ(c, Color(66, 133, 0));
+}
+
+TEST(PacketsLogTest, MixesAndExpiresColors) {
+  PacketsLog<2> log(ColorMixMode::kAdditive, 0);
+  ASSERT_EQ(log.GetColor(0), Color(0, 0, 0));
+  ASSERT_TRUE(log.Update(1000, {100, 0, 0}, kWeightOne, 0));
+  ASSERT_TRUE(log.Update(2000, {200, 50, 0}, kWeightOne, 1000));
+  ASSERT_FALSE(log.Update(3000, {0, 0, 100}, kWeightOne, 1000));
+  ASSERT_EQ(log.GetColor(1000), Color(255, 50, 0));
+
+  // Refreshed entry replaces the old contribution.
+  ASSERT_TRUE(log.Update(1000, {0, 0, 10}, kWeightOne, 2000));
+  ASSERT_EQ(log.GetColor(2000), Color(200, 50, 10));
+  ASSERT_EQ(log.GetColor(2000 + PacketsLog<2>::kWindowMs), Color(0, 0, 0));
+  ASSERT_EQ(log.size(), 0u);
+}
+
+TEST(ScanSchedulerTest, BacksOffWhenQuietAndTightensAfterHit) {
+  ScanScheduler scheduler({.num_channels = 2,
+                           .min_dwell_ms = 100,
+                           .max_dwell_ms = 300,
+                           .min_listen_after_hit_ms = 10,
+                           .max_listen_after_hit_ms = 30,
+                           .min_idle_ms = 50,
+                           .max_idle_ms = 150});
+  const auto quiet_cycle = [&scheduler]() {
+    const auto first = scheduler.NextDwell();
+    scheduler.ReportDwell(false);
+    scheduler.NextDwell();
+    scheduler.ReportDwell(false);
+    return first.idle_before_ms;
+  };
+  ASSERT_EQ(quiet_cycle(), 0u);
+  ASSERT_EQ(quiet_cycle(), 50u);
+  ASSERT_EQ(quiet_cycle(), 100u);
+  ASSERT_EQ(quiet_cycle(), 150u);
+  ASSERT_EQ(quiet_cycle(), 150u);
+
+  scheduler.SetBatteryLevel(0);
+  ASSERT_EQ(quiet_cycle(), 150u * ScanScheduler::kMaxBatteryStretch);
+  scheduler.SetBatteryLevel(100);
+
+  // Hit on channel 1 resets the backoff and makes it dwell longer there.
+  scheduler.NextDwell();
+  scheduler.ReportDwell(false);
+  ASSERT_EQ(scheduler.NextDwell().duration_ms, 100u);
+  scheduler.ReportDwell(true);
+  const auto first = scheduler.NextDwell();
+  ASSERT_EQ(first.idle_before_ms, 0u);
+  ASSERT_EQ(first.duration_ms, 100u);
+  scheduler.ReportDwell(false);
+  const auto active = scheduler.NextDwell();
+  ASSERT_EQ(active.channel, 1);
+  ASSERT_GT(active.duration_ms, 100u);
+  ASSERT_GT(active.listen_after_hit_ms, 10u);
+}
+
+TEST(PowerManagerTest, RunsHooksWithHysteresis) {
+  uint8_t level = 50;
+  PowerManager power_manager({.idle_below = 20, .deep_sleep_below = 10, .system_off_below = 0, .hysteresis = 5,
+                              .check_period_ms = 10, .deep_sleep_check_period_ms = 10},
+                             [&level]() { return level; });
+  int idle_enters = 0, idle_exits = 0, deep_sleep_enters = 0;
+  power_manager.RegisterHooks(
+      PowerState::kIdle, [&idle_enters]() { ++idle_enters; }, [&idle_exits]() { ++idle_exits; });
+  power_manager.RegisterHooks(PowerState::kDeepSleep, [&deep_sleep_enters]() { ++deep_sleep_enters; }, nullptr);
+  const auto settle = [&power_manager]() {
+    k_sleep(K_MSEC(30));
+    power_manager.AwaitTransition(K_NO_WAIT);
+    power_manager.ApplyPendingTransition();
+    return power_manager.GetState();
+  };
+  power_manager.Start();
+  ASSERT_EQ(settle(), PowerState::kActive);
+
+  // Going deeper runs enter hooks of all tiers passed.
+  level = 5;
+  ASSERT_EQ(settle(), PowerState::kDeepSleep);
+  ASSERT_EQ(idle_enters, 1);
+  ASSERT_EQ(deep_sleep_enters, 1);
+
+  // Just above the threshold is not enough to leave the tier.
+  level = 12;
+  ASSERT_EQ(settle(), PowerState::kDeepSleep);
+  level = 15;
+  ASSERT_EQ(settle(), PowerState::kIdle);
+  ASSERT_EQ(idle_exits, 0);
+  level = 25;
+  ASSERT_EQ(settle(), PowerState::kActive);
+  ASSERT_EQ(idle_exits, 1);
+}
+
 RgbLed led;
 
 TEST(RgbLedTest, InstantColorTransition) {
@@ -45,14 +450,113 @@ TEST(RgbLedTest, SmoothColorTransition) {
   led.SetColor({0, 0, 0});
   led.SetColorSmooth({254, 0, 0}, 1000);
   ASSERT_EQ(led.GetColor(), Color(0, 0, 0));
-  k_sleep(K_MSEC(550));
+  k_sleep(K_MSEC(500));
+  // Half of the light, which is perceived brighter than the half of 254.
+  const int half = FromLinear(uint16_t(ToLinear(254) / 2));
   auto r = led.GetColor().r;
-  ASSERT_GE(r, 127 - 10);
-  ASSERT_LE(r, 127 + 10);
+  ASSERT_GE(r, half - 10);
+  ASSERT_LE(r, half + 10);
   k_sleep(K_MSEC(550));
   ASSERT_EQ(led.GetColor().r, 254);
 }
 
+TEST(LedAnimationTest, AssemblesCompactly) {
+  static_assert(lsqFastBlink.size() == 18);
+  const uint8_t expected[] = {4, 3, 1, 255, 255, 255, 3, 100, 0, 1, 0, 0, 0, 3, 100, 0, 5, 0};
+  ASSERT_TRUE(std::equal(lsqFastBlink.begin(), lsqFastBlink.end(), std::begin(expected), std::end(expected)));
+  ASSERT_TRUE(led_animation::Validate(lsqStart));
+}
+
+TEST(LedAnimationTest, RejectsInvalidAnimations) {
+  // Truncated kWait.
+  const uint8_t truncated[] = {3, 100};
+  ASSERT_FALSE(led_animation::Validate(truncated));
+  // kLoop without kEndLoop.
+  const uint8_t unbalanced[] = {4, 2, 3, 100, 0, 0};
+  ASSERT_FALSE(led_animation::Validate(unbalanced));
+  // kJump into the middle of kWait.
+  const uint8_t misaligned[] = {3, 100, 0, 6, 1, 0};
+  ASSERT_FALSE(led_animation::Validate(misaligned));
+  // Runs past the end.
+  const uint8_t unterminated[] = {1, 255, 0, 0};
+  ASSERT_FALSE(led_animation::Validate(unterminated));
+}
+
+namespace {
+constexpr led_animation::Instruction kEventCode[] = {
+    led_animation::Set({255, 0, 0}),
+    led_animation::WaitEvent(kLedEventBeacon),
+    led_animation::Set({0, 255, 0}),
+    led_animation::Wait(20),
+    led_animation::Set({0, 0, 255}),
+    led_animation::End(),
+};
+constexpr auto kEventAnimation = led_animation::Assemble<kEventCode>();
+}  // namespace
+
+TEST(RgbLedSequencerTest, WaitsForEvents) {
+  RgbLedSequencer sequencer(led);
+  sequencer.StartOrRestart(kEventAnimation);
+  ASSERT_EQ(led.GetColor(), Color(255, 0, 0));
+  k_sleep(K_MSEC(30));
+  ASSERT_EQ(led.GetColor(), Color(255, 0, 0));
+  sequencer.Signal(kLedEventBeacon);
+  // Resumes on the next frame tick.
+  k_sleep(K_MSEC(FrameScheduler::kTickMs + 5));
+  ASSERT_EQ(led.GetColor(), Color(0, 255, 0));
+  k_sleep(K_MSEC(30));
+  ASSERT_EQ(led.GetColor(), Color(0, 0, 255));
+}
+
+TEST(FrameSchedulerTest, CoalescesNearbyEffects) {
+  std::atomic<uint8_t> renders = 0;
+  FrameScheduler::Effect a([&renders]() { ++renders; });
+  FrameScheduler::Effect b([&renders]() { ++renders; });
+  // Starts a couple of ms after a tick, so both deadlines are before the next one.
+  k_sleep(K_MSEC(FrameScheduler::kTickMs - k_uptime_get() % FrameScheduler::kTickMs + 2));
+  const uint32_t wakeups = FrameScheduler::GetInstance().GetWakeups();
+  a.RunDelayed(1);
+  b.RunDelayed(4);
+  k_sleep(K_MSEC(2 * FrameScheduler::kTickMs));
+  ASSERT_EQ(renders, 2);
+  ASSERT_EQ(FrameScheduler::GetInstance().GetWakeups() - wakeups, 1u);
+
+  // Nothing is scheduled, so there are no more wakeups.
+  k_sleep(K_MSEC(5 * FrameScheduler::kTickMs));
+  ASSERT_EQ(FrameScheduler::GetInstance().GetWakeups() - wakeups, 1u);
+}
+
+TEST(LedStripTest, EncodesBytesAsSpiBitPatterns) {
+  uint8_t out[4];
+  ASSERT_EQ(LedStripBase::EncodeByte(0x81, out), out + 4);
+  // 1000 for zeros, 1110 for ones.
+  const uint8_t expected[] = {0xE8, 0x88, 0x88, 0x8E};
+  ASSERT_TRUE(std::equal(std::begin(out), std::end(out), std::begin(expected), std::end(expected)));
+}
+
+// Exposes Render, so it can be timed without waiting for the frame scheduler.
+class TestLedStrip : public LedStrip<120> {
+ public:
+  // No SPI, frames are rendered but not sent.
+  TestLedStrip() : LedStrip(nullptr) {}
+  using LedStripBase::Render;
+};
+
+TEST(LedStripTest, RendersLongStripWithinFrame) {
+  static TestLedStrip strip;
+  // Every pixel is fading, that's the slowest case.
+  strip.SetColorSmooth({255, 128, 0}, 100);
+  // Frames requested by SetColorSmooth are rendered in the work queue, don't let it interleave.
+  k_sched_lock();
+  const uint32_t start = k_cycle_get_32();
+  strip.Render();
+  const uint32_t elapsed_us = k_cyc_to_us_floor32(k_cycle_get_32() - start);
+  k_sched_unlock();
+  printk("LedStrip<120>::Render took %u us\n", elapsed_us);
+  // Small fraction of the frame period, so rendering doesn't hold up the radio.
+  ASSERT_LT(elapsed_us, 1000u);
+}
+
 TEST(TimerTest, RunsDelayed) {
   std::atomic<uint8_t> counter = 0;
   const auto t = RunDelayed([&]() { ++counter; }, 30);